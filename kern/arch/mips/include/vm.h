@@ -123,6 +123,7 @@ struct tlbshootdown {
 	 * Change this to what you need for your VM design.
 	 */
 	vaddr_t badaddr;
+	unsigned asid;
 };
 
 #define TLBSHOOTDOWN_MAX 16
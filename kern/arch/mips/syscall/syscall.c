@@ -35,6 +35,7 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <copyinout.h>
 
 
 /*
@@ -81,6 +82,7 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+	off_t pos;
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -128,8 +130,7 @@ syscall(struct trapframe *tf)
 		break;
 
 	    case SYS_waitpid:
-		err = sys_waitpid(tf->tf_a0, (userptr_t) tf->tf_a1, tf->tf_a2);
-		retval = tf->tf_a0; /* we return the user-supplied pid*/
+		err = sys_waitpid(tf->tf_a0, (userptr_t) tf->tf_a1, tf->tf_a2, &retval);
 	    break;
 	    case SYS_execv:
 		err = sys_execv((const char*)tf->tf_a0, (char**)tf->tf_a1);
@@ -151,6 +152,28 @@ syscall(struct trapframe *tf)
         retval = sys_close(tf->tf_a0, &err);
         break;
 
+      case SYS_readv:
+        retval = sys_readv(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &err);
+        break;
+
+      case SYS_writev:
+        retval = sys_writev(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &err);
+        break;
+
+      case SYS_pread:
+      case SYS_pwrite:
+        /* the 64-bit offset is aligned to an even slot, which puts it on the stack past a3 */
+        err = copyin((const_userptr_t)(tf->tf_sp + 16), &pos, sizeof(pos));
+        if (err) {
+          break;
+        }
+        if (callno == SYS_pread) {
+          retval = sys_pread(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, pos, &err);
+        } else {
+          retval = sys_pwrite(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, pos, &err);
+        }
+        break;
+
       case SYS_sbrk:
         retval = sys_sbrk(tf->tf_a0, &err);
 	break;
@@ -12,6 +12,7 @@
 #include <vm.h>
 #include <coremap.h>
 #include <swap.h>
+#include <buddy.h>
 
 // base and bound for vm-managed memory
 paddr_t base;
@@ -28,6 +29,7 @@ vm_bootstrap(){
 	coremap_bootstrap();
 	swap_bootstrap(PAGE_SIZE);
 	spinlock_init(&tlb_lock);
+	coremap_pageout_start();
 }
 
 void
@@ -40,11 +42,12 @@ coremap_bootstrap(){
 		panic("Page sizes other than 4096 bytes not supported.");
 	}
 	int npages = (bound - base) >> VM_PAGEOFFSET;
-	int nbytes = npages * sizeof(struct coremap_entry);
+	int nbytes = npages * (sizeof(struct coremap_entry) + sizeof(struct buddy_node));
 
-	// allocate the coremap right at the base address	
+	// allocate the coremap right at the base address, with the buddy allocator's nodes after it
 	coremap = (struct coremap_entry*) PADDR_TO_KVADDR(base);
 	coremap_length = npages;
+	struct buddy_node *nodes = (struct buddy_node*) (coremap + npages);
 	
 
 	// set the coremap entries for the memory occupied by the coremap itself
@@ -68,6 +71,9 @@ coremap_bootstrap(){
 		bitmap_mark(coremap_free, i);
 		bitmap_mark(coremap_swappable, i);
 	}
+	coremap_free_count = npages - mappages;
+	buddy_bootstrap(nodes, npages);
+	buddy_free(mappages, npages - mappages);
 
 	// now allocate the lock and cv (which uses kmalloc and the coremap as normal)	
 	coremap_lock = lock_create("COREMAP");
@@ -109,40 +115,98 @@ coremap_translate(paddr_t paddr){
 	return idx;
 }
 
+/* Address space IDs are handed out in generations. When they run out a new generation starts,
+ * and each cpu flushes its TLB the next time it activates an address space, so that entries
+ * tagged in an older generation can never be mistaken for ones of the current generation.
+ * Generation 0 is never used; an address space in it has no ID. */
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static unsigned asid_generation = 1;
+static unsigned asid_next = 1; // ID 0 is left for invalid entries
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *tlbshootdown){
+	unsigned asid = curcpu->c_asid;
+
 	spinlock_acquire(&tlb_lock);
-	int tlb_idx = tlb_probe(tlbshootdown->badaddr, 0);
+	int tlb_idx = tlb_probe(tlbshootdown->badaddr | (tlbshootdown->asid << TLBHI_PIDSHIFT), 0);
 	if(tlb_idx >= 0){
-		uint32_t tlb_hi = MIPS_KSEG2 | (tlb_idx << 12);
-		uint32_t tlb_lo = 0;
-		tlb_write(tlb_hi, tlb_lo, tlb_idx);
+		uint32_t tlb_hi = TLBHI_INVALID(tlb_idx);
+		uint32_t tlb_lo = TLBLO_INVALID();
+		tlb_write(tlb_hi | (asid << TLBHI_PIDSHIFT), tlb_lo, tlb_idx);
+	} else {
+		// put the running address space's ID back in entryhi
+		tlb_probe(asid << TLBHI_PIDSHIFT, 0);
 	}
 	spinlock_release(&tlb_lock);
 }
 
-void vm_flush_tlb(int pid){
-	struct cpu *cur = curthread->t_cpu;
+void vm_tlb_activate(struct addrspace *as){
+	// stay on this cpu throughout
+	int spl = splhigh();
 
-	spinlock_acquire(&tlb_lock);
+	spinlock_acquire(&asid_lock);
+	if(as->asid_generation != asid_generation){
+		if(asid_next == NUM_ASID){
+			asid_generation++;
+			asid_next = 1;
+			vmstat_inc(VMSTAT_ASID_ROLLOVERS);
+		}
+		as->asid = asid_next++;
+		as->asid_generation = asid_generation;
+		as->tlb_cpus = 0;
+	}
+	struct cpu *cur = curcpu;
+	KASSERT(cur->c_number < 32);
+	as->tlb_cpus |= (uint32_t)1 << cur->c_number;
+	unsigned generation = asid_generation;
+	unsigned asid = as->asid;
+	spinlock_release(&asid_lock);
 
-	/* Check if the pid doesn't match, invalidate the whole tlb */
-	if(pid == 0 || pid != cur->c_tlb_pid){
+	spinlock_acquire(&tlb_lock);
+	if(cur->c_asid_generation != generation){
 		for(uint32_t i = 0; i < NUM_TLB; i++){
-			uint32_t tlb_hi = MIPS_KSEG2 | (i << 12); // out of range
-			uint32_t tlb_lo = 0; // shouldn't matter
-			tlb_write(tlb_hi, tlb_lo, i);
+			tlb_write(TLBHI_INVALID(i) | (asid << TLBHI_PIDSHIFT), TLBLO_INVALID(), i);
 		}
-		
-		if(pid != 0)
-			cur->c_tlb_pid = pid;
+		cur->c_asid_generation = generation;
+		vmstat_inc(VMSTAT_TLB_FLUSHES);
+	} else {
+		// just load the ID into entryhi; the probe itself doesn't matter
+		tlb_probe(asid << TLBHI_PIDSHIFT, 0);
 	}
+	cur->c_asid = asid;
 	spinlock_release(&tlb_lock);
+
+	splx(spl);
+}
+
+uint32_t vm_tlb_cpus(struct addrspace *as){
+	spinlock_acquire(&asid_lock);
+	uint32_t cpus = as->tlb_cpus;
+	spinlock_release(&asid_lock);
+	return cpus;
+}
+
+void vm_tlb_flush(struct addrspace *as){
+	// the old ID's entries are left to die with its generation
+	spinlock_acquire(&asid_lock);
+	as->asid_generation = 0;
+	spinlock_release(&asid_lock);
+
+	if(as == proc_getas()){
+		vm_tlb_activate(as);
+	}
+}
+
+/* With the entry locked: whether it still maps the given frame */
+static bool vm_entry_maps(struct pagetable_entry *entry, paddr_t paddr){
+  return (entry->flags & PAGETABLE_INMEM) && entry->addr == (paddr >> 12);
 }
 
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress){
   
+  vmstat_inc(VMSTAT_FAULTS);
+
   /* Address out of bounds */
   if(faultaddress >= USERSTACK)
     return 1;
@@ -161,18 +225,30 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
     {
       // no page exists
       
-      if(!as->loading && faultaddress < as->heap_start)
-        return 1;
+      if(as_find_region(as, faultaddress) != NULL)
+      {
+        // first touch of a page of a segment: read it in from the executable
+        int err = as_load_page(as, faultaddress);
+        if(err)
+          return err;
+      }
+      else
+      {
+        if(!as->loading && faultaddress < as->heap_start)
+          return 1;
       
-      if(!as->loading && as->stack_base > faultaddress && as->heap_end < faultaddress)
-        as->stack_base = (faultaddress & PAGE_SIZE);
+        if(!as->loading && as->stack_base > faultaddress && as->heap_end < faultaddress)
+          as->stack_base = (faultaddress & PAGE_SIZE);
 
-      pagetable_pull(as->pages, faultaddress, 0);
+        if(pagetable_pull(as->pages, faultaddress, 0) == 0)
+          return ENOMEM;
+        vmstat_inc(VMSTAT_ZERO_FILLS);
+      }
       newentry = pagetable_lookup(as->pages, faultaddress);      
 
-      spinlock_acquire(&newentry->lock);
+      pagetable_lock_entry(as->pages, faultaddress);
       spinlock_acquire(&tlb_lock);
-      uint32_t tlb_hi = faultaddress & TLBHI_VPAGE;
+      uint32_t tlb_hi = (faultaddress & TLBHI_VPAGE) | (as->asid << TLBHI_PIDSHIFT);
       uint32_t tlb_lo = (newentry->addr << 12) | TLBLO_VALID;
       int tlb_idx = tlb_probe(tlb_hi, 0);
       if(tlb_idx < 0)
@@ -180,20 +256,34 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
       else
         tlb_write(tlb_hi, tlb_lo, tlb_idx);
       spinlock_release(&tlb_lock);
-      spinlock_release(&newentry->lock);
+      pagetable_unlock_entry(as->pages, faultaddress);
       return 0;
     } 
 
-    spinlock_acquire(&newentry->lock);
+    pagetable_lock_entry(as->pages, faultaddress);
+    if(newentry->flags & PAGETABLE_INMEM)
+      vmstat_inc(VMSTAT_TLB_REFILLS);
+    else
+      vmstat_inc(VMSTAT_SWAP_INS);
     while(!(newentry->flags & PAGETABLE_INMEM))
     {
       // don't hold spinlock across the swap-in process, since it may need to sleep
-      spinlock_release(&newentry->lock);
-      pagetable_swap_in(newentry, faultaddress, as->pid);
-      spinlock_acquire(&newentry->lock);
+      pagetable_unlock_entry(as->pages, faultaddress);
+
+      // read ahead only when this fault picks up where the last swap-in left off
+      vaddr_t page = faultaddress & PAGE_FRAME;
+      unsigned window = (page == as->fault_next) ? vm_get_readahead() : 1;
+      unsigned n = pagetable_swap_in_cluster(as->pages, newentry, faultaddress, as->pid, window);
+      as->fault_next = page + n * PAGE_SIZE;
+
+      pagetable_lock_entry(as->pages, faultaddress);
     }    
+    // a TLB miss on a resident page is the only reference information the hardware gives us
+    coremap_mark_page_referenced(newentry->addr << 12);
+    // take back ownership of a formerly shared page once everyone else has let go of it
+    coremap_claim_page(newentry->addr << 12, as->pid);
     spinlock_acquire(&tlb_lock);
-    uint32_t tlb_hi = faultaddress & TLBHI_VPAGE;
+    uint32_t tlb_hi = (faultaddress & TLBHI_VPAGE) | (as->asid << TLBHI_PIDSHIFT);
     uint32_t tlb_lo = (newentry->addr << 12) | TLBLO_VALID;
     int tlb_idx = tlb_probe(tlb_hi, 0);
     if(tlb_idx < 0)
@@ -203,7 +293,7 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
     else 
       tlb_write(tlb_hi, tlb_lo, tlb_idx);
     spinlock_release(&tlb_lock);
-    spinlock_release(&newentry->lock); 
+    pagetable_unlock_entry(as->pages, faultaddress); 
     return 0;
   }
 
@@ -215,23 +305,84 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
     if(!as->loading && as->stack_base > faultaddress &&  as->heap_end < faultaddress)
       return 1;
 
-    bool map = coremap_lock_acquire(newentry->addr << 12);
-    if(!map) 
-      // the memory will become invalid shortly 
-      // return out of trap handler without fixing anything and hope for better luck next time
-      return 0;    
     if(!(newentry->flags & PAGETABLE_WRITEABLE) && !as->loading)
     { // invalid access 
-      coremap_lock_release(newentry->addr << 12);
       return 1;
     }
 
+    // the page may have been evicted since its TLB entry was loaded; if so, fault it back in first
+    pagetable_lock_entry(as->pages, faultaddress);
+    if(!(newentry->flags & PAGETABLE_INMEM))
+    {
+      pagetable_unlock_entry(as->pages, faultaddress);
+      return 0;
+    }
+    paddr_t paddr = newentry->addr << 12;
+    // a shared frame is pinned before anything sleeps, so it can't be handed over and evicted under us
+    bool shared = coremap_pin_shared(paddr);
+    pagetable_unlock_entry(as->pages, faultaddress);
+
+    if(!shared)
+    {
+      if(!coremap_lock_acquire(paddr))
+        // the memory will become invalid shortly 
+        // return out of trap handler without fixing anything and hope for better luck next time
+        return 0;
+
+      // the frame may have been evicted and reused before we got hold of it
+      pagetable_lock_entry(as->pages, faultaddress);
+      bool same = vm_entry_maps(newentry, paddr);
+      pagetable_unlock_entry(as->pages, faultaddress);
+      if(!same)
+      {
+        coremap_lock_release(paddr);
+        return 0;
+      }
+    }
+    else
+    {
+      // copy-on-write: the frame is still shared with another address space, so take a private copy
+      paddr_t copy = coremap_allocate_page(false, as->pid, 1, (userptr_t) (faultaddress & PAGE_FRAME));
+      memcpy((void*) PADDR_TO_KVADDR(copy), (void*) PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+      pagetable_lock_entry(as->pages, faultaddress);
+      if(!vm_entry_maps(newentry, paddr))
+      {
+        // the mapping went away while we copied; let the fault happen again
+        pagetable_unlock_entry(as->pages, faultaddress);
+        coremap_unpin_shared(paddr);
+        coremap_free_page(copy);
+        return 0;
+      }
+      if(coremap_claim_pinned(paddr, as->pid))
+      {
+        // everyone else let go while we copied, which handed the frame to us; keep it instead
+        pagetable_unlock_entry(as->pages, faultaddress);
+        coremap_free_page(copy);
+      }
+      else
+      {
+        // our pin keeps the frame shared, so dropping our reference can't free it
+        coremap_drop_shared(paddr, as->pid);
+        newentry->addr = copy >> 12;
+        pagetable_unlock_entry(as->pages, faultaddress);
+        coremap_unpin_shared(paddr);
+        vmstat_inc(VMSTAT_COW_COPIES);
+      }
+    }
+
+    pagetable_lock_entry(as->pages, faultaddress);
     newentry->flags |= PAGETABLE_DIRTY;
+    // the copy on disk is stale now; a fresh block is found if the page is evicted again
+    unsigned stale = newentry->swap;
+    newentry->swap = SWAP_NOBLOCK;
+    pagetable_unlock_entry(as->pages, faultaddress);
+    swap_free(stale);
 
     coremap_mark_page_dirty(newentry->addr << 12);
+    coremap_mark_page_referenced(newentry->addr << 12);
 
     spinlock_acquire(&tlb_lock);
-    uint32_t tlb_hi = faultaddress & TLBHI_VPAGE;
+    uint32_t tlb_hi = (faultaddress & TLBHI_VPAGE) | (as->asid << TLBHI_PIDSHIFT);
     uint32_t tlb_lo = (newentry->addr << 12) | (TLBLO_VALID | TLBLO_DIRTY);
     int tlb_idx = tlb_probe(tlb_hi, 0);
 
@@ -31,6 +31,10 @@
  * SFS filesystem
  *
  * Directory I/O
+ *
+ * Directories come in two formats (see kern/sfs.h): plain arrays of
+ * entries, searched from the start, and hash tables, searched from
+ * the name's home slot.
  */
 #include <types.h>
 #include <kern/errno.h>
@@ -72,6 +76,32 @@ sfs_writedir(struct sfs_vnode *sv, int slot, struct sfs_direntry *sd)
 	return sfs_metaio(sv, actualpos, sd, sizeof(*sd), UIO_WRITE);
 }
 
+/*
+ * Check if a directory is a hash table.
+ */
+static
+bool
+sfs_dir_ishashed(struct sfs_vnode *sv)
+{
+	return (sv->sv_i.sfi_flags & SFS_INODEF_HASHDIR) != 0;
+}
+
+/*
+ * Compute the home slot of a name in a hashed directory.
+ */
+static
+int
+sfs_dir_hash(const char *name)
+{
+	uint32_t hash = SFS_FNV_OFFSET;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= SFS_FNV_PRIME;
+	}
+	return hash % SFS_DIRHASH_SLOTS;
+}
+
 /*
  * Compute the number of entries in a directory.
  * This actually computes the number of existing slots, and does not
@@ -87,6 +117,10 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_DIR);
 
 	size = sv->sv_i.sfi_size;
+	if (sfs_dir_ishashed(sv) && size != SFS_DIRHASH_SIZE) {
+		panic("sfs: %s: hashed directory %u: Invalid size %llu\n",
+		      sfs->sfs_sb.sb_volname, sv->sv_ino, size);
+	}
 	if (size % sizeof(struct sfs_direntry) != 0) {
 		panic("sfs: %s: directory %u: Invalid size %llu\n",
 		      sfs->sfs_sb.sb_volname, sv->sv_ino, size);
@@ -95,6 +129,54 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+/*
+ * sfs_dir_findname for hashed directories. Probes from the name's
+ * home slot until it finds the name or a slot that was never used.
+ * The empty slot handed back is the first free one on the way, which
+ * is where the name belongs if it's added.
+ */
+static
+int
+sfs_dir_hashfind(struct sfs_vnode *sv, const char *name,
+		 uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_direntry tsd;
+	int home, n, i, result;
+
+	home = sfs_dir_hash(name);
+	for (n=0; n<SFS_DIRHASH_SLOTS; n++) {
+		i = (home + n) % SFS_DIRHASH_SLOTS;
+
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			return result;
+		}
+		/* Ensure null termination, just in case */
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+
+		if (tsd.sfd_ino == SFS_NOINO) {
+			if (emptyslot != NULL && *emptyslot < 0) {
+				*emptyslot = i;
+			}
+			if (tsd.sfd_name[0] == 0) {
+				/* Never used; the name can't be past here */
+				break;
+			}
+		}
+		else if (!strcmp(tsd.sfd_name, name)) {
+			if (slot != NULL) {
+				*slot = i;
+			}
+			if (ino != NULL) {
+				*ino = tsd.sfd_ino;
+			}
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -107,6 +189,10 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	if (sfs_dir_ishashed(sv)) {
+		return sfs_dir_hashfind(sv, name, ino, slot, emptyslot);
+	}
+
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -170,8 +256,14 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
+	/*
+	 * If we didn't get an empty slot, add the entry at the end.
+	 * A hashed directory can't grow, so it's full.
+	 */
 	if (emptyslot < 0) {
+		if (sfs_dir_ishashed(sv)) {
+			return ENOSPC;
+		}
 		emptyslot = sfs_dir_nentries(sv);
 	}
 
@@ -196,6 +288,28 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	int result;
+
+	if (sfs_dir_ishashed(sv)) {
+		/*
+		 * Searches for other names may need to go past this
+		 * slot, so leave the name as a deleted entry - unless
+		 * the next slot was never used, in which case they
+		 * would stop there anyway.
+		 */
+		result = sfs_readdir(sv, (slot + 1) % SFS_DIRHASH_SLOTS, &sd);
+		if (result) {
+			return result;
+		}
+		if (sd.sfd_ino != SFS_NOINO || sd.sfd_name[0] != 0) {
+			result = sfs_readdir(sv, slot, &sd);
+			if (result) {
+				return result;
+			}
+			sd.sfd_ino = SFS_NOINO;
+			return sfs_writedir(sv, slot, &sd);
+		}
+	}
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
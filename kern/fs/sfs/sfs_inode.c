@@ -35,6 +35,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
@@ -42,6 +43,7 @@
 
 /*
  * Write an on-disk inode structure back out to disk.
+ * Call with the vnode locked.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -49,6 +51,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
@@ -60,9 +64,169 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+// Vnode table.
+//
+// All of these are called with sfs_vnlock held.
+
+/*
+ * Find a loaded vnode by inode number.
+ */
+static
+struct sfs_vnode *
+sfs_vnhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	for (sv = sfs->sfs_vnhash[ino % SFS_VNHASH_SIZE];
+	     sv != NULL; sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_vnhash_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned bucket = sv->sv_ino % SFS_VNHASH_SIZE;
+
+	sv->sv_hashnext = sfs->sfs_vnhash[bucket];
+	sfs->sfs_vnhash[bucket] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **pp;
+
+	for (pp = &sfs->sfs_vnhash[sv->sv_ino % SFS_VNHASH_SIZE];
+	     *pp != NULL; pp = &(*pp)->sv_hashnext) {
+		if (*pp == sv) {
+			*pp = sv->sv_hashnext;
+			sv->sv_hashnext = NULL;
+			KASSERT(sfs->sfs_nvnodes > 0);
+			sfs->sfs_nvnodes--;
+			return;
+		}
+	}
+	panic("sfs: %s: vnode %u not in vnode table\n",
+	      sfs->sfs_sb.sb_volname, sv->sv_ino);
+}
+
+/*
+ * Put a vnode at the young end of the inactive list.
+ */
+static
+void
+sfs_inactive_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(!sv->sv_inactive);
+
+	sv->sv_inactive = true;
+	sv->sv_lrunext = NULL;
+	sv->sv_lruprev = sfs->sfs_inacttail;
+	if (sfs->sfs_inacttail != NULL) {
+		sfs->sfs_inacttail->sv_lrunext = sv;
+	}
+	else {
+		sfs->sfs_inacthead = sv;
+	}
+	sfs->sfs_inacttail = sv;
+	sfs->sfs_ninactive++;
+}
+
+static
+void
+sfs_inactive_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(sv->sv_inactive);
+
+	if (sv->sv_lruprev != NULL) {
+		sv->sv_lruprev->sv_lrunext = sv->sv_lrunext;
+	}
+	else {
+		sfs->sfs_inacthead = sv->sv_lrunext;
+	}
+	if (sv->sv_lrunext != NULL) {
+		sv->sv_lrunext->sv_lruprev = sv->sv_lruprev;
+	}
+	else {
+		sfs->sfs_inacttail = sv->sv_lruprev;
+	}
+	sv->sv_lruprev = sv->sv_lrunext = NULL;
+	sv->sv_inactive = false;
+	KASSERT(sfs->sfs_ninactive > 0);
+	sfs->sfs_ninactive--;
+}
+
+/*
+ * Unload inactive vnodes, oldest first, until no more than MAX are
+ * left. Vnodes someone has picked up a passing reference to (that
+ * is, sfs_sync) are skipped.
+ */
+static
+int
+sfs_inactive_trim(struct sfs_fs *sfs, unsigned max)
+{
+	struct sfs_vnode *sv, *next;
+	bool busy;
+	int result;
+
+	for (sv = sfs->sfs_inacthead;
+	     sv != NULL && sfs->sfs_ninactive > max; sv = next) {
+		next = sv->sv_lrunext;
+
+		spinlock_acquire(&sv->sv_absvn.vn_countlock);
+		busy = sv->sv_absvn.vn_refcount != 1;
+		spinlock_release(&sv->sv_absvn.vn_countlock);
+		if (busy) {
+			continue;
+		}
+
+		lock_acquire(sv->sv_lock);
+		result = sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+		if (result) {
+			return result;
+		}
+
+		sfs_inactive_remove(sfs, sv);
+		sfs_vnhash_remove(sfs, sv);
+		vnode_cleanup(&sv->sv_absvn);
+		lock_destroy(sv->sv_lock);
+		kfree(sv);
+	}
+	return 0;
+}
+
+/*
+ * Unload all the inactive vnodes, for unmount.
+ */
+int
+sfs_flush_inactive(struct sfs_fs *sfs)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_vnlock);
+	result = sfs_inactive_trim(sfs, 0);
+	lock_release(sfs->sfs_vnlock);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Vnode lifecycle.
+
 /*
  * Called when the vnode refcount (in-memory usage count) hits zero.
  *
+ * A file that still has links is only moved to the inactive list;
+ * the reference VOP_DECREF hands us becomes the list's.
+ *
  * This function should try to avoid returning errors other than EBUSY.
  */
 int
@@ -70,15 +234,17 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	/*
+	 * Holding the vnode table lock keeps sfs_loadvnode from
+	 * handing out new references to this vnode.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it.
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -88,54 +254,65 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
 
-	/* If there are no on-disk references to the file either, erase it. */
-	if (sv->sv_i.sfi_linkcount == 0) {
-		result = sfs_itrunc(sv, 0);
+	/* Only we can drop the reference the inactive list holds */
+	KASSERT(!sv->sv_inactive);
+
+	/*
+	 * Ours is the only reference, so nobody else can be holding
+	 * the vnode lock or waiting for it.
+	 */
+	lock_acquire(sv->sv_lock);
+
+	if (sv->sv_i.sfi_linkcount > 0) {
+		/*
+		 * Still on disk; keep it loaded. It gets synced when
+		 * it is pushed out, or by sfs_sync before that.
+		 */
+		lock_release(sv->sv_lock);
+		sfs_inactive_add(sfs, sv);
+		result = sfs_inactive_trim(sfs, SFS_INACTIVE_MAX);
+		lock_release(sfs->sfs_vnlock);
 		if (result) {
-			vfs_biglock_release();
-			return result;
+			kprintf("sfs: %s: unloading inactive vnodes: %s\n",
+				sfs->sfs_sb.sb_volname, strerror(result));
 		}
+		return 0;
+	}
+
+	/* There are no on-disk references to the file either; erase it. */
+	result = sfs_itrunc(sv, 0);
+	if (result) {
+		lock_release(sv->sv_lock);
+		lock_release(sfs->sfs_vnlock);
+		return result;
 	}
 
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
-	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
-		sfs_bfree(sfs, sv->sv_ino);
-	}
+	/* and discard the inode */
+	sfs_bfree(sfs, sv->sv_ino);
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_vnhash_remove(sfs, sv);
 
-	vnode_cleanup(&sv->sv_absvn);
+	lock_release(sv->sv_lock);
+	lock_release(sfs->sfs_vnlock);
 
-	vfs_biglock_release();
+	vnode_cleanup(&sv->sv_absvn);
 
 	/* Release the storage for the vnode structure itself. */
+	lock_destroy(sv->sv_lock);
 	kfree(sv);
 
 	/* Done */
@@ -150,42 +327,44 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	sv = sfs_vnhash_find(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
+		if (sv->sv_inactive) {
+			/* Take over the inactive list's reference */
+			sfs_inactive_remove(sfs, sv);
+		}
+		else {
 			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
 		}
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
-	/* Didn't have it loaded; load it */
+	/*
+	 * Didn't have it loaded; load it. The table stays locked
+	 * across the read so nobody else loads it at the same time.
+	 */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -199,6 +378,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -232,23 +412,31 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		      ino, sv->sv_i.sfi_type);
 	}
 
+	sv->sv_lock = lock_create("sfs vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_inactive = false;
+	sv->sv_lruprev = sv->sv_lrunext = NULL;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sfs_vnhash_add(sfs, sv);
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -296,25 +484,20 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
@@ -38,6 +38,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -49,7 +50,7 @@
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
- * except sfs_device.
+ * except sfs_device and sfs_absfs.
  */
 
 /*
@@ -62,8 +63,6 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
 	      uio->uio_offset / SFS_BLOCKSIZE);
@@ -102,11 +101,13 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 }
 
 /*
- * Read a block.
+ * Read a block from the disk itself. This is the fsop_readblock the
+ * buffer cache fills its buffers with.
  */
 int
-sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_readrawblock(struct fs *fs, daddr_t block, void *data, size_t len)
 {
+	struct sfs_fs *sfs = fs->fs_data;
 	struct iovec iov;
 	struct uio ku;
 
@@ -117,11 +118,12 @@ sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 }
 
 /*
- * Write a block.
+ * Write a block to the disk itself, for buffer cache write-back.
  */
 int
-sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_writerawblock(struct fs *fs, daddr_t block, void *data, size_t len)
 {
+	struct sfs_fs *sfs = fs->fs_data;
 	struct iovec iov;
 	struct uio ku;
 
@@ -131,6 +133,48 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 	return sfs_rwblock(sfs, &ku);
 }
 
+/*
+ * Read a block, through the buffer cache.
+ */
+int
+sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct buf *buf;
+	int result;
+
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	result = buffer_read(&sfs->sfs_absfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(data, buffer_map(buf), len);
+	buffer_release(buf);
+	return 0;
+}
+
+/*
+ * Write a block. This only updates the cache; the block goes to disk
+ * when it is evicted or the filesystem is synced.
+ */
+int
+sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct buf *buf;
+	int result;
+
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	result = buffer_get(&sfs->sfs_absfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(buffer_map(buf), data, len);
+	buffer_mark_dirty(buf);
+	buffer_release(buf);
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
@@ -150,16 +194,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,9 +205,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,40 +217,29 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache, and perform the
+	 * requested operation into/out of it.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buffer_read(&sfs->sfs_absfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
 
-	/*
-	 * If it was a write, write back the modified block.
-	 */
-	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+	result = uiomove((char *)buffer_map(buf) + skipstart, len, uio);
+	if (result == 0 && uio->uio_rw == UIO_WRITE) {
+		/* It goes back to disk when the cache writes it back */
+		buffer_mark_dirty(buf);
 	}
+	buffer_release(buf);
 
-	return 0;
+	return result;
 }
 
 /*
@@ -228,6 +250,7 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -257,6 +280,21 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
+	/*
+	 * If the cache has the block, it may be newer than the disk,
+	 * so go through it. Otherwise bypass the cache, so big
+	 * sequential transfers don't push the metadata out of it.
+	 */
+	buf = buffer_peek(&sfs->sfs_absfs, diskblock);
+	if (buf != NULL) {
+		result = uiomove(buffer_map(buf), SFS_BLOCKSIZE, uio);
+		if (result == 0 && uio->uio_rw == UIO_WRITE) {
+			buffer_mark_dirty(buf);
+		}
+		buffer_release(buf);
+		return result;
+	}
+
 	/*
 	 * Do the I/O directly to the uio region. Save the uio_offset,
 	 * and substitute one that makes sense to the device.
@@ -407,6 +445,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,18 +453,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -446,26 +473,22 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = buffer_read(&sfs->sfs_absfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, (char *)buffer_map(buf) + blockoffset, len);
+		buffer_release(buf);
 	}
 	else {
-		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		/* Update the selected region; it's written back later */
+		memcpy((char *)buffer_map(buf) + blockoffset, data, len);
+		buffer_mark_dirty(buf);
+		buffer_release(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
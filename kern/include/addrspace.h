@@ -40,6 +40,21 @@
 
 struct vnode;
 
+/*
+ * A segment defined by as_define_region. Nothing is loaded up front: the first fault on
+ * each page reads the bytes that come from the file (if any) into a fresh zeroed page.
+ */
+#define AS_MAX_REGIONS 8
+
+struct as_region {
+	vaddr_t vbase;		/* first address of the segment */
+	size_t memsize;		/* length in memory; past filesize it is zero-filled */
+	struct vnode *vnode;	/* the executable, once as_map_file attaches it, or NULL */
+	off_t offset;		/* file offset of the segment's first byte */
+	size_t filesize;	/* length of the part that comes from the file */
+	uint8_t flags;		/* PAGETABLE_READABLE etc., for the pages it faults in */
+};
+
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -62,6 +77,11 @@ struct addrspace {
 	struct pagetable *pages; /* the page table for this address space */
 	int pid;
 
+	/* TLB tag, valid only while asid_generation matches the allocator's (see vm_tlb_activate) */
+	unsigned asid;
+	unsigned asid_generation;
+	uint32_t tlb_cpus; /* cpus that have activated it under that ID */
+
 	/* Stuff related to destroying the address space without causing conflicts with demand paging */
 	bool destroying;
 	int destroy_count;
@@ -74,6 +94,13 @@ struct addrspace {
 	vaddr_t heap_end;
 	vaddr_t heap_start;
 	vaddr_t stack_base;
+
+	/* The page a sequential scan would swap in next; drives read-ahead */
+	vaddr_t fault_next;
+
+	/* Segments whose pages haven't all been touched yet are loaded from these */
+	struct as_region regions[AS_MAX_REGIONS];
+	unsigned nregions;
 #endif
 };
 
@@ -114,6 +141,17 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_map_file - back a region defined earlier with part of a file,
+ *                to be read in a page at a time as it is touched.
+ *
+ *    as_find_region - look up the region containing an address.
+ *
+ *    as_load_page - fill in the page of a region holding an address,
+ *                on its first fault.
+ *
+ *    as_prefault - load the untouched region pages of a user buffer
+ *                ahead of file I/O on it.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -132,6 +170,11 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_map_file(struct addrspace *as, vaddr_t vaddr,
+                              struct vnode *v, off_t offset, size_t filesize);
+struct as_region *as_find_region(struct addrspace *as, vaddr_t vaddr);
+int               as_load_page(struct addrspace *as, vaddr_t vaddr);
+int               as_prefault(struct addrspace *as, vaddr_t vaddr, size_t len);
 
 
 /*
@@ -0,0 +1,39 @@
+/* Buddy allocator over the free frames of the coremap, used to find contiguous runs of frames. */
+
+#ifndef BUDDY_H_
+#define BUDDY_H_
+
+/* Free frames are kept in power-of-two blocks, aligned to their size, on one free list per
+ * order; freeing a block merges it with its buddy whenever the buddy is also free. A frame
+ * is free in the coremap_free bitmap exactly when it lies in a block on one of these lists.
+ *
+ * All of these are called with the coremap spinlock held. */
+
+#define BUDDY_MAX_ORDER 10 // largest block is 1024 frames (4MB)
+
+struct buddy_node{
+	unsigned int next; // free list links; only meaningful for the first frame of a free block
+	unsigned int prev;
+	uint8_t order; // order of the free block starting at this frame, or BUDDY_NOT_HEAD
+};
+
+/* Takes over an array of nframes nodes (one per coremap frame), with every frame allocated */
+void
+buddy_bootstrap(struct buddy_node *nodes, unsigned int nframes);
+
+/* Finds npages contiguous free frames and removes them from the free lists. Only the frames
+ * asked for are taken; the rest of the power-of-two block goes straight back. Returns ENOSPC
+ * if no block is big enough. */
+int
+buddy_alloc(unsigned int npages, unsigned int *idx);
+
+/* Returns any run of frames to the free lists */
+void
+buddy_free(unsigned int idx, unsigned int npages);
+
+/* Removes one particular free frame from the free lists, for when a frame is chosen by
+ * position rather than by the allocator */
+void
+buddy_claim(unsigned int idx);
+
+#endif
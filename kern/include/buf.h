@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Disk buffer cache.
+ *
+ * Blocks are cached by (filesystem, block number) and reached through
+ * the filesystem's fsop_readblock and fsop_writeblock. A buffer handed
+ * out by buffer_read or buffer_get is busy: it belongs to the caller
+ * alone until buffer_release. Writes only mark the buffer dirty; dirty
+ * buffers go to disk when they are evicted or on buffer_sync.
+ *
+ * Buffers are replaced least-recently-used first. Their memory comes
+ * from kmalloc (and so from the coremap), up to a budget that can be
+ * changed at runtime with buffer_set_budget.
+ */
+
+struct fs;
+struct buf;
+
+/* Size of every cached block; filesystems using the cache must match it */
+#define BUFFER_SIZE 512
+
+/* Default and smallest budgets, in buffers */
+#define BUFFER_DEFAULT_MAX 128
+#define BUFFER_MIN 8
+
+/* Call once during system startup. */
+void buffer_bootstrap(void);
+
+/*
+ * Get the buffer for BLOCK of FS, reading it in if it isn't cached.
+ * buffer_get is for callers about to overwrite the whole block: a
+ * block that isn't cached isn't read, and its contents are undefined.
+ * buffer_peek returns only a buffer that is already cached, or NULL.
+ * If the cache is full and every idle buffer has failed to write back,
+ * buffer_read and buffer_get fail with EIO.
+ */
+int buffer_read(struct fs *fs, daddr_t block, struct buf **ret);
+int buffer_get(struct fs *fs, daddr_t block, struct buf **ret);
+struct buf *buffer_peek(struct fs *fs, daddr_t block);
+
+/* The block's data, BUFFER_SIZE bytes */
+void *buffer_map(struct buf *buf);
+
+/* Mark a busy buffer as needing to be written back */
+void buffer_mark_dirty(struct buf *buf);
+
+/* Give a busy buffer back to the cache */
+void buffer_release(struct buf *buf);
+
+/* Write back every dirty buffer of FS */
+int buffer_sync(struct fs *fs);
+
+/* Forget a block (or all of FS's blocks) without writing it back */
+void buffer_drop(struct fs *fs, daddr_t block);
+void buffer_drop_fs(struct fs *fs);
+
+/*
+ * Change the memory budget, in kilobytes. Returns EINVAL if too small.
+ * Shrinking evicts buffers down to the new budget straight away.
+ */
+int buffer_set_budget(unsigned kbytes);
+
+/* Hit and disk request counters, for the kernel menu */
+void buffer_printstats(void);
+void buffer_resetstats(void);
+
+#endif /* _BUF_H_ */
@@ -12,19 +12,32 @@ unsigned int coremap_length;
 struct spinlock coremap_spinlock;
 
 struct bitmap *coremap_free;
+unsigned int coremap_free_count; // frames unset in coremap_free; protected by coremap_spinlock
 struct bitmap *coremap_swappable;
 
 struct lock *coremap_lock;
 struct cv *coremap_cv;
 
+#define COREMAP_PREFETCHED 64
+#define COREMAP_SHARED 32
+#define COREMAP_REFERENCED 16
 #define COREMAP_INUSE 8
 #define COREMAP_SWAPPABLE 4
 #define COREMAP_MULTI 2
 #define COREMAP_DIRTY 1
 
+/* Page replacement policies used by locate_swap() */
+#define COREMAP_POLICY_RANDOM 0
+#define COREMAP_POLICY_CLOCK 1
+#define COREMAP_POLICY_AGING 2
+
 struct coremap_entry{
 	uint8_t flags;
+	uint8_t age; // reference history for the aging policy; most recent sweep in the high bit
+	uint16_t refs; // number of page-table entries mapping this frame (0 for kernel or free frames)
 	uint16_t pid; // limits.h restricts the PID to this size; if that changes, this must too
+	              // (for a shared frame, the xor of every mapper's pid)
+	uint16_t pins; // copy-on-write faults copying out of this shared frame right now
 	userptr_t vaddr;
 };
 
@@ -34,6 +47,11 @@ coremap_bootstrap(void);
 paddr_t
 coremap_allocate_page(bool iskern, int pid, int npages, userptr_t vaddr);
 
+/* Starts the pageout daemon, which evicts pages in the background to keep some frames free.
+ * Call once swap is available. */
+void
+coremap_pageout_start(void);
+
 // only use before VM system is fully running
 paddr_t
 coremap_allocate_early(int npages);
@@ -41,6 +59,12 @@ coremap_allocate_early(int npages);
 paddr_t
 coremap_swap_page(unsigned int diskblock, userptr_t vaddr, int pid);
 
+/* Claims a frame for a page about to be read in from swap by the caller (locked, as with
+ * coremap_swap_page). Read-ahead passes prefetch=true: the frame is only taken if one is free,
+ * and 0 is returned otherwise, so speculative reads never push out resident pages. */
+paddr_t
+coremap_swap_frame(userptr_t vaddr, int pid, bool prefetch);
+
 void 
 coremap_free_page(paddr_t paddr);
 
@@ -64,6 +88,64 @@ coremap_mark_page_dirty(paddr_t paddr);
 void 
 coremap_mark_page_clean(paddr_t paddr);
 
+/* Copy-on-write sharing. A shared frame is pinned in memory (held in the swappable map), since
+ * eviction works on behalf of a single owner. While it is shared, the frame's pid holds the xor of
+ * the pids of everyone mapping it, so when all but one have let go it names the one left over.
+ *
+ * coremap_share_page adds pid's reference to a resident user page; it fails if the page is
+ * currently being swapped out. coremap_claim_page returns true if the frame is (or has just
+ * become) private to the caller, making pid its owner. coremap_drop_shared releases pid's reference
+ * to a shared frame, and returns false if the frame was not shared. The last reference frees the
+ * frame; with one reference left, the frame passes to that owner and can be evicted again.
+ *
+ * A copy-on-write fault pins the shared frame with coremap_pin_shared before it copies out of it,
+ * which may sleep; a pinned frame stays shared (and resident) even as the other mappers let go.
+ * coremap_pin_shared fails if the frame is not shared. coremap_unpin_shared gives the pin back,
+ * and settles the frame as coremap_drop_shared would have if it is no longer really shared.
+ * coremap_claim_pinned trades the caller's pin for the frame itself if pid is the only mapper
+ * left: the frame becomes private to pid and stays held as with coremap_lock_acquire. */
+
+bool
+coremap_share_page(paddr_t paddr, int pid);
+
+bool
+coremap_claim_page(paddr_t paddr, int pid);
+
+bool
+coremap_drop_shared(paddr_t paddr, int pid);
+
+bool
+coremap_pin_shared(paddr_t paddr);
+
+void
+coremap_unpin_shared(paddr_t paddr);
+
+bool
+coremap_claim_pinned(paddr_t paddr, int pid);
+
+/* Records that a user page was just touched (called from the TLB fault path) */
+void
+coremap_mark_page_referenced(paddr_t paddr);
+
+/* Selects the page replacement policy; returns EINVAL for an unknown policy */
+int
+coremap_set_policy(int policy);
+
+int
+coremap_get_policy(void);
+
+/* Contention on the coremap spinlock: how often it was taken, and how often it was already held
+ * by someone else at the time */
+void
+coremap_get_lockstats(unsigned int *acquires, unsigned int *contended);
+
+void
+coremap_reset_lockstats(void);
+
+/* Number of user page mappings backed by a resident frame (a shared frame counts once per sharer) */
+unsigned int
+coremap_resident_mappings(void);
+
 /* An architecture-specific translator between a paddr and the index into that frame of the coremap 
  * These do not check that the values given are valid for memory contained in the coremap */
 int
@@ -35,6 +35,12 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+/* Number of scheduling priority levels (run queues per cpu); 0 is the highest */
+#define SCHED_NQUEUES 4
+
+/* Size of each cpu's free-frame cache */
+#define FRAMECACHE_MAX 16
+
 
 /*
  * Per-cpu structure
@@ -61,14 +67,24 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
-	int c_tlb_pid;			/* Process represented in TLB */
+	unsigned c_asid;		/* Address space ID loaded in the MMU */
+	unsigned c_asid_generation;	/* ASID generation the TLB holds */
+
+	/*
+	 * Cache of free page frames (coremap indices), taken from
+	 * and returned to the coremap in batches so that single-page
+	 * allocations and frees usually avoid the coremap spinlock.
+	 * Only touched by this cpu, with interrupts off.
+	 */
+	unsigned c_frames[FRAMECACHE_MAX];
+	unsigned c_numframes;
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NQUEUES]; /* Run queues for this cpu, by priority */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -108,6 +124,12 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Total number of frames in the cpus' free-frame caches; a hint, read
+ * without locks.
+ */
+unsigned cpu_cachedframes(void);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -151,6 +173,7 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_batch queues several shootdowns behind a single IPI.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -165,6 +188,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_batch(struct cpu *target,
+			    const struct tlbshootdown *mappings, unsigned num);
 
 void interprocessor_interrupt(void);
 
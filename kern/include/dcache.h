@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+/*
+ * Directory name lookup cache.
+ *
+ * Maps (directory vnode, name) to the vnode the name refers to, or
+ * to nothing for a name known not to exist. Entries hold references
+ * to both vnodes. Filesystems that use the cache fill it from their
+ * lookup operation and invalidate names in their create, link,
+ * remove, and rename operations, all with the directory locked, so
+ * the cache never disagrees with the directory. vfs_lookup consults
+ * it before calling VOP_LOOKUP on a single name.
+ *
+ * Entries are replaced least-recently-used first once there are
+ * DCACHE_MAX of them.
+ */
+
+struct fs;
+struct vnode;
+
+#define DCACHE_MAX 256
+
+/* Call once during system startup. */
+void dcache_bootstrap(void);
+
+/*
+ * Look NAME up in DIR. Returns false on a miss. On a hit, returns
+ * true and sets *RET to a new reference to the vnode, or to NULL if
+ * the name is known not to exist.
+ */
+bool dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret);
+
+/* Record that NAME in DIR is VN (NULL if it doesn't exist). */
+void dcache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+
+/* Forget NAME in DIR. */
+void dcache_invalidate(struct vnode *dir, const char *name);
+
+/* Forget every name in directories of FS, e.g. before unmount. */
+void dcache_purge_fs(struct fs *fs);
+
+/* Hit and miss counters, for the kernel menu */
+void dcache_printstats(void);
+void dcache_resetstats(void);
+
+#endif /* _DCACHE_H_ */
@@ -51,6 +51,8 @@ struct fs {
  *      fsop_getvolname - Return volume name of filesystem.
  *      fsop_getroot    - Return root vnode of filesystem.
  *      fsop_unmount    - Attempt unmount of filesystem.
+ *      fsop_readblock  - Read a block straight from the device.
+ *      fsop_writeblock - Write a block straight to the device.
  *
  * fsop_getvolname may return NULL on filesystem types that don't
  * support the concept of a volume name. The string returned is
@@ -68,12 +70,20 @@ struct fs {
  * consequently the struct fs instance should remain valid. On success,
  * however, the filesystem object and all storage associated with the
  * filesystem should have been discarded/released.
+ *
+ * fsop_readblock and fsop_writeblock are what the buffer cache (buf.h)
+ * uses to fill and write back its buffers; they bypass the cache.
+ * Filesystems that don't use the cache may leave them NULL.
  */
 struct fs_ops {
 	int           (*fsop_sync)(struct fs *);
 	const char   *(*fsop_getvolname)(struct fs *);
 	int           (*fsop_getroot)(struct fs *, struct vnode **);
 	int           (*fsop_unmount)(struct fs *);
+	int           (*fsop_readblock)(struct fs *, daddr_t block,
+					void *data, size_t len);
+	int           (*fsop_writeblock)(struct fs *, daddr_t block,
+					 void *data, size_t len);
 };
 
 /*
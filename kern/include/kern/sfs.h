@@ -67,6 +67,32 @@
 #define SFS_TYPE_FILE     1
 #define SFS_TYPE_DIR      2
 
+/* Flags for sfi_flags */
+#define SFS_INODEF_HASHDIR 0x1    /* directory is a hash table */
+
+/*
+ * Hashed directories.
+ *
+ * A directory with SFS_INODEF_HASHDIR set is an open-addressed hash
+ * table of SFS_DIRHASH_SLOTS entries, and is always exactly that big.
+ * A name lives in the first usable slot at or after (wrapping around)
+ * its home slot, which is the 32-bit FNV-1a hash of the name's bytes
+ * (without the terminating null) modulo SFS_DIRHASH_SLOTS.
+ *
+ * A slot with sfd_ino == SFS_NOINO and an empty name has never been
+ * used, and ends a search. A slot with sfd_ino == SFS_NOINO that
+ * still has a name is a deleted entry: searches go past it, and new
+ * entries may reuse it.
+ *
+ * Directories without the flag are plain arrays of entries, searched
+ * from the start. Any hashed directory is also a valid plain one once
+ * the flag is cleared and its deleted entries are zeroed.
+ */
+#define SFS_DIRHASH_SLOTS 1024
+#define SFS_DIRHASH_SIZE  (SFS_DIRHASH_SLOTS * sizeof(struct sfs_direntry))
+#define SFS_FNV_OFFSET    2166136261U
+#define SFS_FNV_PRIME     16777619U
+
 /*
  * On-disk superblock
  */
@@ -86,7 +112,8 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_flags;			/* SFS_INODEF_* above */
+	uint32_t sfi_waste[128-4-SFS_NDIRECT];	/* unused space, set to 0 */
 };
 
 /*
@@ -10,30 +10,30 @@
 #include <coremap.h>
 #include <swap.h>
 
-struct pagetable_entry{
-	struct spinlock lock;
-	paddr_t addr;
-	unsigned int swap;
-	uint8_t flags;
-};
+/* Entries are packed into two words and stored inline in page-sized leaves, PAGETABLE_LEAF_SIZE
+ * to a leaf. A directory of leaves covers the user half of the address space. Every entry in a
+ * leaf is protected by the leaf's spinlock (see pagetable_lock_entry); the reader-writer lock
+ * protects the shape of the tree, so walks that only touch existing leaves share it and only
+ * adding a leaf or tearing the table down takes it exclusively. An all-zero entry is invalid. */
 
-struct pagetable_subptr {
-  struct pagetable_entry *entries[1024];
-};
+#define PAGETABLE_LEAF_BITS 9
+#define PAGETABLE_LEAF_SIZE (1 << PAGETABLE_LEAF_BITS)
+#define PAGETABLE_DIR_SIZE (1 << (31 - 12 - PAGETABLE_LEAF_BITS))
 
-struct pagetable_subtable {
-  struct bitmap *valids;
-  struct pagetable_subptr *ptr;
+struct pagetable_entry{
+	unsigned int addr : 20; // physical frame number, while PAGETABLE_INMEM
+	unsigned int flags : 8;
+	unsigned int swap; // swap block, or SWAP_NOBLOCK
 };
 
-struct pagetable_ptr {
-  struct pagetable_subtable *entries[1024];
+struct pagetable_leaf {
+  struct spinlock lock;
+  struct pagetable_entry *entries; // one page
 };
 
 struct pagetable {
-  struct bitmap *valids;
-  struct pagetable_ptr *ptr;
-  struct lock *pagetable_lock;
+  struct pagetable_leaf **leaves; // one page; NULL where nothing has been mapped
+  struct rwlock *pagetable_lock;
 };
 
 #define PAGETABLE_VALID 1
@@ -45,30 +45,41 @@ struct pagetable {
 #define PAGETABLE_EXECUTABLE 64
 #define PAGETABLE_REQUEST_DESTROY 128
 
-/* Swaps the given entry from disk into memory, adjusting the entry as needed */
-void pagetable_swap_in(struct pagetable_entry *entry, vaddr_t vaddr, int pid);
+/* Swaps in the given entry along with up to window - 1 following pages that sit on the following
+ * disk blocks, in a single read. Returns the number of pages brought in. */
+unsigned pagetable_swap_in_cluster(struct pagetable *table, struct pagetable_entry *entry, vaddr_t vaddr, int pid, unsigned window);
+
+/* Gives the entry a swap block, near its neighbours' if possible, unless it already has one */
+int pagetable_assign_swap(struct pagetable *table, struct pagetable_entry *entry, vaddr_t vaddr);
 
-/* Allocates a new page in physical memory, adjusting the table entry as needed */
+/* Allocates a new page in physical memory, adjusting the table entry as needed. Returns 0 if
+ * the page can't be mapped (out of memory or swap space). */
 paddr_t pagetable_pull(struct pagetable* table, vaddr_t vaddr, uint8_t flags);
 
 /* Creates a pagetable tree structure */
 struct pagetable *pagetable_create(void);
 
-/* Returns the entry for a given vaddr, or NULL if none exists */
+/* Returns the entry for a given vaddr, or NULL if none exists. Entries never move, so the pointer
+ * stays good until the table is destroyed. */
 struct pagetable_entry
 *pagetable_lookup(struct pagetable* table, vaddr_t vaddr);
 
+/* Take and release the spinlock protecting the entry for vaddr, which must exist */
+void pagetable_lock_entry(struct pagetable *table, vaddr_t vaddr);
+void pagetable_unlock_entry(struct pagetable *table, vaddr_t vaddr);
+
 /* Helper for pagetable_pull */
 bool pagetable_add(struct pagetable* table, vaddr_t vaddr, paddr_t paddr, uint8_t flags);
 
-/* Removes the page of the given vaddr, freeing space in memory and on disk */
-bool pagetable_remove(struct pagetable* table, vaddr_t vaddr);
+/* Removes the page of the given vaddr, freeing space in memory and on disk; pid owns the table */
+bool pagetable_remove(struct pagetable* table, vaddr_t vaddr, int pid);
 
 /* Copies the entire tree structure of a page table */
 bool pagetable_copy(struct pagetable *old, int oldpid, struct pagetable *copy, int copypid);
 
-/* Frees all of the pages (which aren't currently being swapped), and returns the number of failures */
-int pagetable_free_all(struct pagetable* table);
+/* Frees all of the pages (which aren't currently being swapped), and returns the number of failures;
+ * pid owns the table */
+int pagetable_free_all(struct pagetable* table, int pid);
 
 /* Destroyes the tree structure, orphaning any extant physical page frames or swap pages */
 int pagetable_destroy(struct pagetable* table);
@@ -35,68 +35,74 @@
 
 
 /*
-	A data structure for maintaining a directory for the pids - process ids, currently in use
-
-	Synchronization is the responsibility of the caller, with a lock provided on every tree-node for the caller's use
-	This is because the caller may need to transact multiple operations, or hold the lock longer than is obvious
+	A table of the pids - process ids, currently in use, indexed directly by pid
+
+	The table is two levels: a fixed directory of leaves, each leaf a page of slots allocated the first
+	time a pid in its range is handed out. Leaves are never freed while the table exists, and a slot is
+	a single pointer, so pid_get_proc needs no lock at all and never sees a torn slot while another
+	thread forks or exits. It does not keep the process it returns alive, though: callers must already
+	know the process can't be destroyed under them (a parent looking up its own child, say). Anyone
+	else, such as eviction, goes through proc_lookup, which takes a reference.
+
+	Allocating and removing pids is the responsibility of the caller to synchronize, with the table's
+	lock provided for the caller's use. proc_create and proc_destroy hold it just around the one call;
+	waiting and exiting synchronize through the processes' own wait_locks instead.
 */
 
-// size (number of subtree branches) of each tree node
-#define PID_DIR_SIZE 8
+#define PID_LEAF_BITS 10
+#define PID_LEAF_SIZE (1 << PID_LEAF_BITS)
+#define PID_DIR_SIZE ((PID_MAX >> PID_LEAF_BITS) + 1)
 
 // from proc.h
 struct proc;
 
-struct pid_tree{
-	// lock for altering this level of the tree
+struct pid_table{
+	// lock for allocating and removing pids
 	struct lock *lock;
 
-	// pointer to parent of the tree
-	struct pid_tree *parent;
+	// slots, PID_LEAF_SIZE to a leaf; NULL where the pid is free
+	struct proc *volatile *volatile leaves[PID_DIR_SIZE];
 
-	// pid/proc pairs kept at this level of the tree
-	int local_pids[PID_DIR_SIZE];
-	struct proc *local_procs[PID_DIR_SIZE];
+	// where the search for the next free pid starts, so pids aren't reused right away
+	int next_pid;
 
-	// pointers to subtrees, and counts of pids actively allocated per subtree
-	// subtree i is responsible for the address space between local_pid[i] 
-	// to local_pid[i+1] or the end of the space
-	int subtree_sizes[PID_DIR_SIZE];
-	struct pid_tree* subtrees[PID_DIR_SIZE];
+	// number of pids in use
+	int count;
 };
 
 /*
-	Initializes the first tree block and returns. 
+	Initializes an empty table and returns it. 
 
 	KProc, the kernel process, is designated with reserved pid = 0
 */
-struct pid_tree *pid_create_tree(struct proc *kproc);
+struct pid_table *pid_create_table(struct proc *kproc);
 
 /*
-	Allocates a new pid for the given process, attaches the process to the tree, and returns the pid
+	Allocates a new pid for the given process, attaches the process to the table, and returns the pid
+	Returns -1 if every pid is in use, or a leaf can't be allocated
 */
-int pid_allocate(struct pid_tree *tree, struct proc *next_proc);
+int pid_allocate(struct pid_table *table, struct proc *next_proc);
 
 /*
 	Locates the given pid and returns the process associated with it, if one exists.
-	Returns -1 if the process does not exist. 
+	Returns NULL if the process does not exist. Does not need the lock.
 */
-struct proc *pid_get_proc(struct pid_tree *tree, int pid);
+struct proc *pid_get_proc(struct pid_table *table, int pid);
 
 /*
-	Locates the given pid and removes its process from the tree, returning it
+	Locates the given pid and removes its process from the table, returning it
 */
-struct proc *pid_remove_proc(struct pid_tree *tree, int pid);
+struct proc *pid_remove_proc(struct pid_table *table, int pid);
 
 /*
-	Destroyes the given tree-block and all of its children, recursively, detatching from the parent if one is present.
+	Destroys the given table.
 	Returns 1 on success
-	Will fail with 0 if any active processes exist in the tree
+	Will fail with 0 if any active processes exist in the table
 */
-int pid_destroy_tree(struct pid_tree *tree);
+int pid_destroy_table(struct pid_table *table);
 
-void pid_acquire_lock(struct pid_tree *tree);
+void pid_acquire_lock(struct pid_table *table);
 
-void pid_release_lock(struct pid_tree *tree);
+void pid_release_lock(struct pid_table *table);
 
  #endif /* _PID_H_ */
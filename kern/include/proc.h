@@ -41,17 +41,21 @@
 #include <synch.h>
 #include <pid.h>
 #include <list.h>
-#include <hashtable.h>
+#include <array.h>
 #include <pagetable.h>
 
 struct addrspace;
 struct thread;
 struct vnode;
+struct filecontrolblock;
+
+/* Descriptors below this are the console, opened on first use; open() hands out the rest */
+#define FD_FIRST_FREE 3
 
 /* 
  * The process directory, which matches process ids to processes. 
  */
-struct pid_tree *pids;
+struct pid_table *pids;
 
 /*
  * Process structure.
@@ -74,9 +78,11 @@ struct proc {
 	char *p_name;			/* Name of this process */
 	struct spinlock p_lock;		/* Lock for this structure */
 	unsigned p_numthreads;		/* Number of threads in this process */
+	unsigned p_refcount;		/* proc_lookup references, plus one for the pid table */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct addrspace *p_oldas;	/* address space being destroyed at exit, still reachable by eviction */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
@@ -88,13 +94,15 @@ struct proc {
 	int waitpid;			/* the process id being waited for, if any (-1 if none) */
 
 	struct cv *wait;			/* parent waits on their own cv (child signals as it exits) */
+	struct lock *wait_lock;		/* protects waitpid, children and zombies, and our own parent link */
 
 	struct list *children; /* the process ids for the children of this process (if any) */
+	struct list *zombies;	/* exited children not yet waited for, oldest first */
 
-	struct hashtable *files;		/* the file descriptors for this process's open files (no duplicates!) */
-
-  int next_fd;
+	struct array *files;		/* open files, indexed by file descriptor; NULL where free */
+	struct rwlock *files_lock;		/* lookups read, opening and closing write */
 
+	/* Set by the exiting process holding both its own and its parent's wait_lock */
 	int exit_val;			/* value that this process exited with (if it has exited) */
 	bool exited;			/* whether the process has exited */
 };
@@ -111,26 +119,47 @@ struct proc *proc_create_runprogram(const char *name, int *error);
 /* Fork a fresh process from an existing process */
 struct proc *proc_create_fork(const char *name, struct proc *parent, int *error);
 
-/* Exits from a process, including detatching from open files and orphaning child processes */
+/* Exits from a process, including detatching from open files and orphaning child processes.
+ * Only the parent's and children's wait_locks are taken; there is no global lock. */
 void proc_exit(struct proc *proc, int exitcode);
 
-/* Destroys the remnant of an exited process */
+/* Destroys the remnant of an exited process. Its pid goes at once; the structure itself is freed
+ * once any proc_lookup references are released. */
 void proc_destroy(struct proc *proc);
 
+/* Looks up a process by pid and takes a reference to it, so it is not freed under the caller even
+ * if it exits meanwhile; returns NULL if the pid is not in use. For callers (such as eviction) that
+ * have nothing else keeping the process alive. Drop the reference with proc_release. */
+struct proc *proc_lookup(int pid);
+
+void proc_release(struct proc *proc);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
-/* Adds the given file descriptor to the process's list of open files */
-int proc_addfile(struct proc *proc, char* fd, void* controlblock);
+/* Installs an open file at the lowest free descriptor no lower than minfd, returning it in fd_ret.
+ * Returns EMFILE if the table is full, or ENOMEM. The table takes over the caller's reference. */
+int proc_addfile(struct proc *proc, struct filecontrolblock *ctrl, int minfd, int *fd_ret);
+
+/* Looks up the open file for the given descriptor, or NULL. The process's own threads are the only
+ * ones that close its descriptors, so the result stays good until it closes it. */
+struct filecontrolblock *proc_getfile(struct proc *proc, int fd);
+
+/* Removes the given file descriptor from the table and returns its open file (with the table's
+ * reference), or NULL if it was not open */
+struct filecontrolblock *proc_remfile(struct proc *proc, int fd);
 
-/* Removes the given file descriptor from the process's list of open files */
-void proc_remfile(struct proc *proc, int fd);
+/* Waits for the given child (or any child, for pid == -1) to exit, and returns it in child_ret without
+ * reaping it, so its exit value can be delivered first. Returns ECHILD if there is no such child (ESRCH
+ * if the pid is not in use at all). If block is false and no such child has exited yet, returns 0 with
+ * a NULL child. The child stays a zombie until proc_reap; only the process's own thread reaps it. */
+int proc_wait(struct proc *proc, int pid, bool block, struct proc **child_ret);
 
-/* Removes the given pid from the process's list of children */
-void proc_remchild(struct proc *proc, int child);
+/* Removes an exited child returned by proc_wait from the parent's lists, and destroys it. */
+void proc_reap(struct proc *proc, struct proc *child);
 
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
@@ -48,25 +48,56 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Size of the per-volume hash table of loaded vnodes, and how many
+ * vnodes nobody is using are kept loaded in case they're wanted again.
+ */
+#define SFS_VNHASH_SIZE 256
+#define SFS_INACTIVE_MAX 64
+
 /*
  * In-memory inode
+ *
+ * sv_lock covers sv_i, sv_dirty, and the file's contents (for a
+ * directory, its entries). sv_ino and the inode type never change
+ * once the vnode is loaded and may be read without it.
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
+	struct lock *sv_lock;           /* protects inode and contents */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_vnode *sv_hashnext;  /* next in vnode hash chain */
+	bool sv_inactive;               /* on the inactive list */
+	struct sfs_vnode *sv_lruprev;   /* inactive list links */
+	struct sfs_vnode *sv_lrunext;
 };
 
 /*
  * In-memory info for a whole fs volume
+ *
+ * Lock order: a directory's sv_lock, then a file's sv_lock, then
+ * sfs_vnlock, then sfs_freemaplock.
+ *
+ * Every loaded vnode is in sfs_vnhash, hashed by inode number. When
+ * the last reference to a vnode goes away it stays loaded, holding
+ * that reference itself, on the inactive list (least recently used
+ * first) until it is needed again or pushed out by newer ones. The superblock's volume name
+ * never changes after mount and may be read without a lock.
  */
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;        /* protects vnode table */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASH_SIZE]; /* loaded vnodes */
+	unsigned sfs_nvnodes;           /* number of loaded vnodes */
+	struct sfs_vnode *sfs_inacthead; /* inactive list, oldest first */
+	struct sfs_vnode *sfs_inacttail;
+	unsigned sfs_ninactive;         /* number on the inactive list */
+	struct lock *sfs_freemaplock;   /* protects freemap, superblock */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
 };
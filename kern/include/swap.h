@@ -11,6 +11,10 @@
 /* For the interface with pagetables, disk pointers are represented as unsigned indices 
  * into a logical array in the swap file. */
 
+/* Block index of a page that has no copy on disk. Blocks are only assigned when a dirty page
+ * is first swapped out; a clean page without a block is all zeroes. */
+#define SWAP_NOBLOCK ((unsigned int) -1)
+
 void
 swap_bootstrap(size_t page_size);
 
@@ -18,15 +22,48 @@ swap_bootstrap(size_t page_size);
 int
 swap_allocate(unsigned int *block);
 
+/* As swap_allocate, but prefers hint or the first free block after it, so that pages which are
+ * neighbours in memory end up as neighbours on disk and can be read and written together */
+int
+swap_allocate_near(unsigned int hint, unsigned int *block);
+
 void
 swap_free(unsigned int block);
 
+/* Swap space accounting. Every valid user page holds a reservation, taken when it is first
+ * mapped, so that any page can always be given a block when it is evicted. Reserving fails
+ * with ENOMEM once every block in the swap space is spoken for. */
+int
+swap_reserve(unsigned int npages);
+
+void
+swap_unreserve(unsigned int npages);
+
+/* Releases a page's claim on swap entirely: its block, if it has one, and its reservation */
+void
+swap_discard(unsigned int block);
+
+/* Number of blocks in the swap space, reserved, and actually holding a page */
+void
+swap_getstats(unsigned int *total, unsigned int *reserved, unsigned int *used);
+
 /* Write page to disk */
 void 
 swap_page_out(void* kvaddr, unsigned int block);
 
+/* Largest number of pages written by one clustered write */
+#define SWAP_CLUSTER_MAX 16
+
+/* Write npages pages to consecutive blocks on disk, starting at block, in a single request */
+void
+swap_pages_out(void **kvaddrs, unsigned int block, unsigned int npages);
+
 /* Read page from disk */
 void 
 swap_page_in(void* kvaddr, unsigned int block);
 
+/* Read npages pages from consecutive blocks on disk, starting at block, in a single request */
+void
+swap_pages_in(void **kvaddrs, unsigned int block, unsigned int npages);
+
 #endif
@@ -36,6 +36,7 @@
 
 
 #include <spinlock.h>
+#include <kern/time.h>
 
 /*
  * Dijkstra-style semaphore.
@@ -76,10 +77,21 @@ struct lock {
         char *lk_name;
         // add what you need here
         volatile struct thread *lock_holder;
+        struct cpu *volatile lk_holdercpu; // cpu the holder took it on (cpus are never freed)
         volatile bool is_locked;
         struct wchan *lock_wchan;
         struct spinlock lock_spinlock;
 
+        // contention statistics, protected by lock_spinlock
+        unsigned lk_acquires;           // total acquisitions
+        unsigned lk_contended;          // acquisitions that found it held
+        unsigned lk_spun;               // contended ones won by spinning alone
+        struct timespec lk_waittime;    // total time spent waiting
+
+        // list of all locks, for lockstat
+        struct lock *lk_next;
+        struct lock *lk_prev;
+
         // (don't forget to mark things volatile as needed)
 };
 
@@ -101,6 +113,18 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
+/*
+ * Locks are adaptive: a thread that finds the lock held spins for a
+ * while if the holder is running on another cpu, and only sleeps if
+ * the holder is not running or the spin budget runs out.
+ *
+ *    lockstat_print - Print contention statistics for the most
+ *                     contended locks.
+ *    lockstat_reset - Zero the statistics of every lock.
+ */
+void lockstat_print(void);
+void lockstat_reset(void);
+
 
 /*
  * Condition variable.
@@ -144,4 +168,51 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Under RWLOCK_FAIR, readers that queue up behind a writer are all
+ * let in when it releases, ahead of the next writer, so neither side
+ * can starve the other. Under RWLOCK_WRITER_PREF a waiting writer
+ * always goes first, for structures where updates must not be held
+ * up by a steady stream of readers.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+#define RWLOCK_FAIR        0
+#define RWLOCK_WRITER_PREF 1
+
+struct rwlock {
+        char *rwlock_name;
+        struct lock *rw_lock;           // protects the fields below
+        struct cv *rw_readcv;
+        struct cv *rw_writecv;
+        int rw_policy;
+        unsigned rw_readers;            // readers holding the lock
+        unsigned rw_readers_waiting;
+        unsigned rw_writers_waiting;
+        unsigned rw_readturn;           // waiting readers to admit ahead of writers
+        struct thread *rw_writer;       // writer holding the lock, if any
+};
+
+struct rwlock *rwlock_create(const char *name, int policy);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock exclusively.
+ *    rwlock_release_write - Give up the write hold; only the writer may.
+ *    rwlock_do_i_hold_write - True if the current thread is the writer.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
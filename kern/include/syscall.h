@@ -36,13 +36,22 @@
 #include <proc.h>
 struct trapframe; /* from <machine/trapframe.h> */
 
+/* An open file. Shared between descriptors by fork; the last descriptor closed closes the vnode. */
 typedef struct filecontrolblock
 {
   struct vnode* node;
   off_t offset;
   int permissions;
+  unsigned refcount;        // descriptors referring to this open file
+  struct lock *offset_lock; // serializes I/O through the shared offset; protects refcount
 } fcblock;
 
+/* Creates an open file with one reference, taking over the caller's reference to the vnode */
+fcblock *fcblock_create(struct vnode *node, int permissions);
+void fcblock_incref(fcblock *ctrl);
+/* Drops a reference, closing the vnode and freeing the block on the last one */
+void fcblock_decref(fcblock *ctrl);
+
 /*
  * The system call dispatcher.
  */
@@ -75,7 +84,7 @@ int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 */
 int sys_getpid(void);
 int sys_fork(struct trapframe *tf, int *error);
-int sys_waitpid(int pid, userptr_t status, int options);
+int sys_waitpid(int pid, userptr_t status, int options, int *retval);
 int sys_execv(const char *program, char **args);
 
 int sys_sbrk(intptr_t amount, int *error);
@@ -84,6 +93,10 @@ int sys_open(const char *filename, int flags, int *error);
 ssize_t sys_read(int fd, void *buf, size_t buflen, int *error);
 ssize_t sys_write(int fd, const void *buf, size_t nbytes, int *error);
 int sys_close(int fd, int *error);
+ssize_t sys_readv(int fd, userptr_t iov, int iovcnt, int *error);
+ssize_t sys_writev(int fd, userptr_t iov, int iovcnt, int *error);
+ssize_t sys_pread(int fd, userptr_t buf, size_t buflen, off_t pos, int *error);
+ssize_t sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t pos, int *error);
 int close_from_process(int fd, int *error, struct proc *p);
 
 void sys__exit(int exitcode);
@@ -58,6 +58,7 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int rwlocktest(int, char **);
 
 /* deterministic synchronization tests */
 int locktests_det_reacquire(int nargs, char **args);
@@ -88,6 +88,9 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_priority;		/* Run queue level; 0 is highest */
+	unsigned t_ticks;		/* Ticks used at this level */
+	unsigned t_queuedat;		/* t_cpu's hardclock when last queued */
 
 	/*
 	 * Interrupt state fields.
@@ -191,13 +194,23 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for a clock tick. Returns true if it
+ * should give up the cpu, because it has used up its quantum (and
+ * drops a priority level) or a higher priority thread is waiting.
+ * Called from the timer interrupt.
+ */
+bool thread_tick(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
-void vm_tlbshootdown_all(vaddr_t badaddr);
+struct addrspace;
+void vm_tlbshootdown_page(struct addrspace *as, vaddr_t badaddr);
+void vm_tlbshootdown_pages(struct addrspace *as, const vaddr_t *addrs, unsigned num);
 
 
 #endif /* _THREAD_H_ */
@@ -194,8 +194,8 @@ DECLARRAY(vnode, VFSINLINE);
 DEFARRAY(vnode, VFSINLINE);
 
 /*
- * Global one-big-lock for all filesystem operations.
- * You must remove this for the filesystem assignment.
+ * Global one-big-lock. It now covers only the VFS mount list, the
+ * boot filesystem, and emufs; SFS locks its own vnodes and volumes.
  */
 void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
@@ -57,11 +57,56 @@ void free_kpages(vaddr_t addr);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
-/* TLB shootdown handler - will interrupt every cpu; implemented in thread.c */
-void vm_tlbshootdown_all(vaddr_t badaddr);
+struct addrspace;
 
-/* flush the TLB if this pid doesn't match */
-void vm_flush_tlb(int pid);
+/* Removes the address space's mappings of the given pages from every TLB that may hold them,
+ * interrupting each other cpu concerned once per batch; implemented in thread.c */
+void vm_tlbshootdown_page(struct addrspace *as, vaddr_t badaddr);
+void vm_tlbshootdown_pages(struct addrspace *as, const vaddr_t *addrs, unsigned num);
+
+/* The cpus (one bit per cpu number) whose TLBs may hold entries for the address space */
+uint32_t vm_tlb_cpus(struct addrspace *as);
+
+/* Makes as the address space the TLB translates for, giving it an address space ID if it
+ * doesn't have a current one. The TLB is only flushed when the IDs have wrapped around. */
+void vm_tlb_activate(struct addrspace *as);
+
+/* Drops all of the address space's TLB entries by giving it a fresh address space ID */
+void vm_tlb_flush(struct addrspace *as);
+
+/* Event counters for comparing page replacement policies (see the vmstat menu command) */
+#define VMSTAT_FAULTS        0    /* calls to vm_fault */
+#define VMSTAT_TLB_REFILLS   1    /* faults satisfied by a resident page */
+#define VMSTAT_ZERO_FILLS    2    /* faults satisfied by a fresh zeroed page */
+#define VMSTAT_SWAP_INS      3    /* faults that had to read their page back from swap */
+#define VMSTAT_EVICTIONS     4    /* user pages pushed out of memory */
+#define VMSTAT_REF_CLEARS    5    /* reference bits cleared by the replacement policy */
+#define VMSTAT_SWAP_READS    6    /* pages read from the swap disk */
+#define VMSTAT_SWAP_WRITES   7    /* pages written to the swap disk */
+#define VMSTAT_COW_COPIES    8    /* shared pages copied on first write */
+#define VMSTAT_DIRECT_EVICTIONS 9 /* evictions a faulting thread had to do itself */
+#define VMSTAT_PAGEOUT_BATCHES 10 /* batches evicted by the pageout daemon */
+#define VMSTAT_PREFETCHED    11   /* pages read ahead of a sequential fault */
+#define VMSTAT_PREFETCH_HITS 12   /* read-ahead pages that were later used */
+#define VMSTAT_PREFETCH_WASTED 13 /* read-ahead pages evicted without being used */
+#define VMSTAT_FRAME_REFILLS 14   /* per-cpu frame caches refilled from the coremap */
+#define VMSTAT_FRAME_DRAINS  15   /* per-cpu frame caches drained back to the coremap */
+#define VMSTAT_TLB_FLUSHES   16   /* whole-TLB flushes after the address space IDs wrapped */
+#define VMSTAT_ASID_ROLLOVERS 17  /* times the address space IDs ran out */
+#define VMSTAT_SHOOTDOWN_IPIS 18  /* TLB shootdown interrupts sent to other cpus */
+#define VMSTAT_SHOOTDOWN_PAGES 19 /* pages shot down */
+#define VMSTAT_EXEC_PAGEINS  20   /* faults that read their page from the executable */
+#define VMSTAT_NUM           21
+
+void vmstat_inc(int stat);
+void vmstat_add(int stat, unsigned n);
+void vmstat_reset(void);
+void vmstat_print(void);
+
+/* Number of pages read per swap-in once a sequential fault pattern is seen; 1 disables read-ahead */
+#define VM_READAHEAD_DEFAULT 8
+unsigned vm_get_readahead(void);
+int vm_set_readahead(unsigned window);
 
 
 #endif /* _VM_H_ */
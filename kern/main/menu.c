@@ -36,11 +36,16 @@
 #include <uio.h>
 #include <clock.h>
 #include <thread.h>
+#include <synch.h>
 #include <proc.h>
 #include <vfs.h>
+#include <buf.h>
+#include <dcache.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <vm.h>
+#include <coremap.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 
@@ -118,9 +123,7 @@ common_prog(int nargs, char **args)
 	int error;
 
 	/* Create a process for the new program to run in. */
-	pid_acquire_lock(pids);
 	proc = proc_create_runprogram(args[0] /* name */, &error);
-	pid_release_lock(pids);
 
 	if (proc == NULL) {
 		return error;
@@ -132,9 +135,7 @@ common_prog(int nargs, char **args)
 			args /* thread arg */, nargs /* thread arg */);
 	if (result) {
 		kprintf("thread_fork failed: %s\n", strerror(result));
-		pid_acquire_lock(pids);
 		proc_exit(proc, 0);
-		pid_release_lock(pids);
 		return result;
 	}
 
@@ -143,7 +144,7 @@ common_prog(int nargs, char **args)
 	 * once you write the code for handling that.
 	 */
 
-	sys_waitpid(proc->pid, NULL, 0);
+	sys_waitpid(proc->pid, NULL, 0, NULL);
 
 	return 0;
 }
@@ -411,6 +412,126 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		vmstat_print();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vmstat_reset();
+	}
+	else {
+		kprintf("Usage: vmstat [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_print();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+	}
+	else {
+		kprintf("Usage: lockstat [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_bufstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		buffer_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		buffer_resetstats();
+	}
+	else {
+		kprintf("Usage: bufstat [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_bufsize(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: bufsize kilobytes\n");
+		return EINVAL;
+	}
+
+	return buffer_set_budget(atoi(args[1]));
+}
+
+static
+int
+cmd_dcstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		dcache_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		dcache_resetstats();
+	}
+	else {
+		kprintf("Usage: dcstat [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_vmreadahead(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: vmreadahead pages\n");
+		return EINVAL;
+	}
+
+	return vm_set_readahead(atoi(args[1]));
+}
+
+static
+int
+cmd_vmpolicy(int nargs, char **args)
+{
+	int policy;
+
+	if (nargs != 2) {
+		kprintf("Usage: vmpolicy random|clock|aging\n");
+		return EINVAL;
+	}
+
+	if (!strcmp(args[1], "random")) {
+		policy = COREMAP_POLICY_RANDOM;
+	}
+	else if (!strcmp(args[1], "clock")) {
+		policy = COREMAP_POLICY_CLOCK;
+	}
+	else if (!strcmp(args[1], "aging")) {
+		policy = COREMAP_POLICY_AGING;
+	}
+	else {
+		kprintf("Unknown replacement policy %s\n", args[1]);
+		return EINVAL;
+	}
+
+	return coremap_set_policy(policy);
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -489,6 +610,7 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] RW lock test [wpref]          ",
         "[dsy0-9] Deterministic sync. tests  ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
@@ -528,6 +650,13 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[vmstat] VM fault and swap counters ",
+	"[vmpolicy] Set page replacement     ",
+	"[vmreadahead] Set swap read-ahead   ",
+	"[lockstat] Lock contention counters ",
+	"[bufstat] Buffer cache counters     ",
+	"[bufsize] Set buffer cache size     ",
+	"[dcstat] Name cache counters        ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -577,6 +706,13 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "vmstat",     cmd_vmstat },
+	{ "vmpolicy",   cmd_vmpolicy },
+	{ "vmreadahead", cmd_vmreadahead },
+	{ "lockstat",   cmd_lockstat },
+	{ "bufstat",    cmd_bufstat },
+	{ "bufsize",    cmd_bufsize },
+	{ "dcstat",     cmd_dcstat },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -603,6 +739,7 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwlocktest },
 
     /* deterministic tests for synchronization */
     { "dsy0", locktests_det_reacquire },
@@ -28,215 +28,157 @@
  */
 
 #include <types.h>
+#include <lib.h>
+#include <membar.h>
 #include <current.h>
 #include <pid.h>
 
-int pid_allocate_helper(struct pid_tree *tree, struct proc *proc, int pid_min, int pid_max);
+struct pid_table *pid_create_table(struct proc *kproc){
+	struct pid_table *table;
+	table = kmalloc(sizeof(*table));
 
-struct pid_tree *pid_create_tree(struct proc *kproc){
-	struct pid_tree *tree;
-	tree = kmalloc(sizeof(*tree));
-
-	if(tree == NULL){
+	if(table == NULL){
 		return NULL;
 	}
 
-	tree->lock = lock_create("PID_DIRECTORY_TREE");
-	if(tree->lock == NULL){
-		kfree(tree);
+	table->lock = lock_create("PID_TABLE");
+	if(table->lock == NULL){
+		kfree(table);
 		return NULL;
 	}
 
-	tree->parent = NULL;
-
 	for(int i = 0; i < PID_DIR_SIZE; i++){
-		tree->local_pids[i] = -1;
-		tree->local_procs[i] = NULL;
-		tree->subtree_sizes[i] = 0;
-		tree->subtrees[i] = NULL;
+		table->leaves[i] = NULL;
 	}
+	table->next_pid = PID_MIN;
+	table->count = 0;
 
 	// Assign the kernel process to pid = 0
 	if(kproc != NULL){
-		tree->local_pids[0] = 0;
-		tree->local_procs[0] = kproc;
+		table->leaves[0] = kmalloc(PID_LEAF_SIZE * sizeof(struct proc *));
+		if(table->leaves[0] == NULL){
+			lock_destroy(table->lock);
+			kfree(table);
+			return NULL;
+		}
+		for(int i = 0; i < PID_LEAF_SIZE; i++){
+			table->leaves[0][i] = NULL;
+		}
+		table->leaves[0][0] = kproc;
+		table->count = 1;
 	}
 
-	return tree;
+	return table;
 }
 
-int pid_allocate(struct pid_tree *tree, struct proc *proc){
-	
-	if(tree == NULL){
-		return -1;
+// returns the leaf holding the pid, allocating it if need be; the lock must be held
+static
+struct proc *volatile *pid_get_leaf(struct pid_table *table, int pid){
+	int dir = pid >> PID_LEAF_BITS;
+	if(table->leaves[dir] != NULL){
+		return table->leaves[dir];
 	}
 
-	int pid_min = PID_MIN;
-	int pid_max = PID_MAX;
+	struct proc *volatile *leaf = kmalloc(PID_LEAF_SIZE * sizeof(struct proc *));
+	if(leaf == NULL){
+		return NULL;
+	}
+	for(int i = 0; i < PID_LEAF_SIZE; i++){
+		leaf[i] = NULL;
+	}
 
-	return pid_allocate_helper(tree, proc, pid_min, pid_max);
+	// lookups may find the leaf as soon as it's published; it has to be empty by then
+	membar_store_store();
+	table->leaves[dir] = leaf;
+	return leaf;
 }
 
-int pid_allocate_helper(struct pid_tree *tree, struct proc *proc, int pid_min, int pid_max){
+int pid_allocate(struct pid_table *table, struct proc *proc){
 	
-	// see if there are open spots in this block
-	for(int i = 0; i < PID_DIR_SIZE; i++){
-		// the given pid-slot is unassigned
-		if(tree->local_procs[i] == NULL){
-
-			// pick a pid that divides the address space into similar-sized components
-			int pid = pid_min + (i) * (pid_max - pid_min) / PID_DIR_SIZE;
-
-			// if we have a pid hanging around, its correct relative to nearby subtrees; use it
-			if(tree->local_pids[i] != -1){
-				pid = tree->local_pids[i];
-			}
-
-			tree->local_pids[i] = pid;
-			tree->local_procs[i] = proc;
-			return pid;
-		}
-	}
-
-	// find the least-full subtree
-	int max = tree->subtree_sizes[0];
-	int idx = 0;
-	for(int i = 1; i < PID_DIR_SIZE; i++){
-		if(tree->subtree_sizes[i] < max){
-			max = tree->subtree_sizes[i];
-			idx = i;
-		}
+	if(table == NULL){
+		return -1;
 	}
 
-	// if the subtree doesn't exist, create it
-	if(tree->subtrees[idx] == NULL){
-		tree->subtrees[idx] = pid_create_tree(NULL);
-		// if we can't create it, return -1 as an error
-		if(tree->subtrees[idx] == NULL){
+	// search round from where the last allocation left off
+	int pid = table->next_pid;
+	for(int tries = 0; tries <= PID_MAX - PID_MIN; tries++){
+		struct proc *volatile *leaf = pid_get_leaf(table, pid);
+		if(leaf == NULL){
 			return -1;
 		}
-		tree->subtrees[idx]->parent = tree;
-	}
 
-	// update subtree count  
-	tree->subtree_sizes[idx] += 1;
+		if(leaf[pid & (PID_LEAF_SIZE - 1)] == NULL){
+			// the process must be fully set up before a lookup can find it
+			membar_store_store();
+			leaf[pid & (PID_LEAF_SIZE - 1)] = proc;
+			table->count++;
+			table->next_pid = pid == PID_MAX ? PID_MIN : pid + 1;
+			return pid;
+		}
 
-	//search recursively
-	if(pid_min < tree->local_pids[idx] + 1){
-		// only false if we're dealing with KPROC; pid = 1 may not be a valid pid, though pid = 0 is	
-		pid_min = tree->local_pids[idx] + 1;
-	}
-	if(idx < PID_DIR_SIZE - 1){
-		pid_max = tree->local_pids[idx + 1] - 1;
+		pid = pid == PID_MAX ? PID_MIN : pid + 1;
 	}
 
-	return pid_allocate_helper(tree->subtrees[idx], proc, pid_min, pid_max);
+	return -1;
 }
 
-struct proc *pid_get_proc(struct pid_tree *tree, int pid){
-	// this is a non-binary search tree
-
-	if(tree == NULL){
+struct proc *pid_get_proc(struct pid_table *table, int pid){
+	if(table == NULL || pid < 0 || pid > PID_MAX){
 		return NULL;
 	}
 
-	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(pid == tree->local_pids[i]){
-			return tree->local_procs[i];
-		} else if(pid < tree->local_pids[i]){
-			// we need to search between pid[i - 1] < pid < pid[i]
-			if(i == 0){
-				// falling off the front, there are no pids small enough to match
-				return NULL;
-			}
-			return pid_get_proc(tree->subtrees[i - 1], pid);
-		}
+	struct proc *volatile *leaf = table->leaves[pid >> PID_LEAF_BITS];
+	if(leaf == NULL){
+		return NULL;
 	}
-
-	// check the last subtree
-	return pid_get_proc(tree->subtrees[PID_DIR_SIZE - 1], pid);
+	membar_load_load();
+	return leaf[pid & (PID_LEAF_SIZE - 1)];
 }
 
-struct proc *pid_remove_proc(struct pid_tree *tree, int pid){
-	// first we have to FIND the pid
-	if(tree == NULL){
+struct proc *pid_remove_proc(struct pid_table *table, int pid){
+	if(table == NULL || pid < 0 || pid > PID_MAX){
 		return NULL;
 	}
 
-	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(pid == tree->local_pids[i]){
-			// we found it!
-			struct proc *proc = tree->local_procs[i];
-			tree->local_procs[i] = NULL;
-
-			// we want to keep the pid paired with a NULL block if there are subtrees to either side
-			if(tree->subtree_sizes[i] == 0){
-				if(i == 0 || tree->subtree_sizes[i - 1] == 0){
-					tree->local_pids[i] = -1;
-				}
-			}
-
-			// if the block is now empty, remove it from the parent and decrement sizes up the tree
-			struct pid_tree *parent = tree->parent;
-			while(parent != NULL){
-				for(int j = PID_DIR_SIZE -1; j >= 0; j--){
-					if(parent->local_pids[j] < pid){
-						parent->subtree_sizes[j]--;
-						int size = parent->subtree_sizes[j];
-						if(size == 0){ 
-							pid_destroy_tree(parent->subtrees[j]);
-							parent->subtrees[j] = NULL;
-						}
-						break;
-					}
-				}
-				parent = parent->parent;
-			}
-			return proc;	
-		} else if(pid < tree->local_pids[i]){
-			// we need to search between pid[i - 1] < pid < pid[i], which is subtree[i - 1]
-			if(i == 0){
-				// falling off the front, there are no pids small enough to match
-				return NULL;
-			}
-			return pid_remove_proc(tree->subtrees[i - 1], pid);
-		}
+	struct proc *volatile *leaf = table->leaves[pid >> PID_LEAF_BITS];
+	if(leaf == NULL){
+		return NULL;
 	}
 
-	// check the last subtree
-	return pid_remove_proc(tree->subtrees[PID_DIR_SIZE - 1], pid);
+	struct proc *proc = leaf[pid & (PID_LEAF_SIZE - 1)];
+	if(proc != NULL){
+		leaf[pid & (PID_LEAF_SIZE - 1)] = NULL;
+		table->count--;
+	}
+	return proc;
 }
 
-int pid_destroy_tree(struct pid_tree *tree){
-	if(tree == NULL){
+int pid_destroy_table(struct pid_table *table){
+	if(table == NULL){
+		return 0;
+	}
+
+	// an active process exists
+	if(table->count > 0){
 		return 0;
 	}
 
 	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(tree->subtrees[i] != NULL){
-			// recursively destroy down the tree
-			int det = pid_destroy_tree(tree->subtrees[i]);
-			if(!det){
-				return 0;
-			}
-			tree->subtrees[i] = NULL;
-		}
-		// an active process exists
-		if(tree->local_procs[i] != NULL){
-			return 0;
+		if(table->leaves[i] != NULL){
+			kfree((void *) table->leaves[i]);
 		}
 	}
 
-	lock_destroy(tree->lock);
-	kfree(tree);
+	lock_destroy(table->lock);
+	kfree(table);
 
 	return 1;
 }
 
-void pid_acquire_lock(struct pid_tree *tree){
-	lock_acquire(tree->lock);
+void pid_acquire_lock(struct pid_table *table){
+	lock_acquire(table->lock);
 }
 
-void pid_release_lock(struct pid_tree *tree){
-	lock_release(tree->lock);
+void pid_release_lock(struct pid_table *table){
+	lock_release(table->lock);
 }
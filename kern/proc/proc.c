@@ -57,6 +57,9 @@
  */
 struct proc *kproc;
 
+/* Protects p_refcount, and orders proc_lookup against removal from the pid table */
+static struct spinlock proc_reflock = SPINLOCK_INITIALIZER;
+
 /* Original destructor code; detatches and cleans up OS161-provided fields*/
 void proc_detatch(struct proc *proc);
 
@@ -82,10 +85,12 @@ proc_create(const char *name, int *error)
 	}
 
 	proc->p_numthreads = 0;
+	proc->p_refcount = 1;
 	spinlock_init(&proc->p_lock);
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_oldas = NULL;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
@@ -98,7 +103,7 @@ proc_create(const char *name, int *error)
 		return NULL;
 	}
 
-	proc->files = hashtable_create();
+	proc->files = array_create();
 	if(proc->files == NULL){
 		*error = ENOMEM;
 		list_destroy(proc->children);
@@ -107,10 +112,46 @@ proc_create(const char *name, int *error)
 		return NULL;
 	}
 
+	proc->files_lock = rwlock_create("PROC FILES", RWLOCK_FAIR);
+	if(proc->files_lock == NULL){
+		*error = ENOMEM;
+		array_destroy(proc->files);
+		list_destroy(proc->children);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+
+	proc->zombies = list_create();
+	if(proc->zombies == NULL){
+		*error = ENOMEM;
+		rwlock_destroy(proc->files_lock);
+		array_destroy(proc->files);
+		list_destroy(proc->children);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+
 	proc->wait = cv_create("PROC WAITPID CV");
 	if(proc->wait == NULL){
 		*error = ENOMEM;
-		hashtable_destroy(proc->files);
+		list_destroy(proc->zombies);
+		rwlock_destroy(proc->files_lock);
+		array_destroy(proc->files);
+		list_destroy(proc->children);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+
+	proc->wait_lock = lock_create("PROC WAITPID LOCK");
+	if(proc->wait_lock == NULL){
+		*error = ENOMEM;
+		cv_destroy(proc->wait);
+		list_destroy(proc->zombies);
+		rwlock_destroy(proc->files_lock);
+		array_destroy(proc->files);
 		list_destroy(proc->children);
 		kfree(proc->p_name);
 		kfree(proc);
@@ -119,16 +160,21 @@ proc_create(const char *name, int *error)
 	
 	if(pids == NULL){
 		// Should be only the bootstrapping kernel process
-		pids = pid_create_tree(proc);
+		pids = pid_create_table(proc);
 		proc->pid = 0;
 	} else {
-		// Assign a pid and add to directory tree
+		// Assign a pid and add to the table
+		pid_acquire_lock(pids);
 		proc->pid = pid_allocate(pids, proc);
+		pid_release_lock(pids);
 		if(proc->pid < 0){
 			*error = ENPROC;
+			lock_destroy(proc->wait_lock);
 			cv_destroy(proc->wait);
+			list_destroy(proc->zombies);
+			rwlock_destroy(proc->files_lock);
 			list_destroy(proc->children);
-			hashtable_destroy(proc->files);
+			array_destroy(proc->files);
 			kfree(proc->p_name);
 			kfree(proc);
 			return NULL;
@@ -139,7 +185,6 @@ proc_create(const char *name, int *error)
 	proc->waitpid = -1;
 	proc->exited = false;
 	proc->exit_val = 0;
-  proc->next_fd = 3;
 	return proc;
 }
 
@@ -209,22 +254,45 @@ proc_detatch(struct proc *proc)
 		 * have finished running and exited. It is quite
 		 * incorrect to destroy the proc structure of some
 		 * random other process while it's still running...
+		 *
+		 * The pageout daemon finds a page's address space
+		 * through its process, and as_destroy waits for any
+		 * page it is in the middle of evicting; p_oldas keeps
+		 * the address space reachable until then.
 		 */
 		struct addrspace *as;
 
+		spinlock_acquire(&proc->p_lock);
+		as = proc->p_addrspace;
+		proc->p_addrspace = NULL;
+		proc->p_oldas = as;
+		spinlock_release(&proc->p_lock);
 		if (proc == curproc) {
-			as = proc_setas(NULL);
 			as_deactivate();
 		}
-		else {
-			as = proc->p_addrspace;
-			proc->p_addrspace = NULL;
-		}
 		as_destroy(as);
+
+		spinlock_acquire(&proc->p_lock);
+		proc->p_oldas = NULL;
+		spinlock_release(&proc->p_lock);
 	}
 
+	/* p_lock stays usable until the structure is freed, as proc_lookup callers may still take it */
 	KASSERT(proc->p_numthreads == 0);
-	spinlock_cleanup(&proc->p_lock);
+}
+
+static
+int
+proc_pidcmp(void *left, void *right)
+{
+	return *(int *) left - *(int *) right;
+}
+
+static
+int
+proc_ptrcmp(void *left, void *right)
+{
+	return left != right;
 }
 
 /* 
@@ -233,6 +301,10 @@ proc_detatch(struct proc *proc)
 
 	Also detatches from open files and orphans (destroying if necessary)
 	any child processes. 
+
+	Lock order is child before parent: an exiting process holds its own wait_lock while
+	it hands its exit value to its parent, so the parent can't orphan it (and go away)
+	in the middle. The parent in turn takes each child's wait_lock without its own.
 */
 void 
 proc_exit(struct proc *proc, int exitcode)
@@ -240,19 +312,22 @@ proc_exit(struct proc *proc, int exitcode)
 	/* First, detatch */
 	proc_detatch(proc);
 	
-	/* orphan children */
+	/* orphan children; only our own thread adds to or removes from the list */
 	int *childpid = list_front(proc->children);
 	while(childpid != NULL){
 		struct proc *child = pid_get_proc(pids, *childpid);
 		if(child != NULL){
 			KASSERT(child->pid == *childpid);
 
+			lock_acquire(child->wait_lock);
 			if(child->exited){
 				// child is exited, will now never be joined
+				lock_release(child->wait_lock);
 				proc_destroy(child);
 			} else{
 				// orphan a running child
 				child->parent = -1;
+				lock_release(child->wait_lock);
 			}
 		}
 
@@ -265,43 +340,65 @@ proc_exit(struct proc *proc, int exitcode)
 	// actually destroy the list
 	list_destroy(proc->children);
 	proc->children = NULL;
+
+	/* the zombies were destroyed above; a child that exited while we were orphaning may
+	   still hold our wait_lock, so let it finish first */
+	lock_acquire(proc->wait_lock);
+	while(!list_isempty(proc->zombies)){
+		list_pop_front(proc->zombies);
+	}
+	lock_release(proc->wait_lock);
+	list_destroy(proc->zombies);
+	proc->zombies = NULL;
   
-  // detach from files
-  int error;
-	for(int i = 0; i < proc->next_fd; i++)
-  {
-    close_from_process(i, &error, proc);
-  }
-	hashtable_destroy(proc->files);
+	// detach from files
+	int error;
+	for(unsigned i = 0; i < array_num(proc->files); i++){
+		if(array_get(proc->files, i) != NULL){
+			close_from_process(i, &error, proc);
+		}
+	}
+	array_setsize(proc->files, 0);
+	array_destroy(proc->files);
 	proc->files = NULL;
+	rwlock_destroy(proc->files_lock);
+	proc->files_lock = NULL;
 
-	/* destroy own cv */
+	/* destroy own cv; our children are orphaned, so nobody can signal it any more */
 	cv_destroy(proc->wait);
 	proc->wait = NULL;
 
-	if(proc->parent == -1){
-		// process is already orphaned
-		proc_destroy(proc);
-		return;
-	} 
+	lock_acquire(proc->wait_lock);
+
+	struct proc *parent = NULL;
+	if(proc->parent != -1){
+		parent = pid_get_proc(pids, proc->parent);
+	}
 
-	struct proc *parent = pid_get_proc(pids, proc->parent);
 	if(parent == NULL){
-		// parent process could not be found
+		// process is already orphaned, or the parent could not be found
+		lock_release(proc->wait_lock);
 		proc_destroy(proc);
 		return;
-	}
+	} 
 
 	// now we have an existing parent, so we can't simply destroy everything ...
 
-	/* Set internal exit data */
+	/* Set internal exit data, and queue ourselves for the parent's waitpid. If there's no
+	   memory to queue, a wait for any child won't see us, but one for our pid still will */
+	lock_acquire(parent->wait_lock);
 	proc->exited = true;
 	proc->exit_val = exitcode;
+	list_push_back(parent->zombies, proc);
 
-	if(parent->waitpid == proc->pid){
-		cv_broadcast(parent->wait, pids->lock);
+	if(parent->waitpid == proc->pid || parent->waitpid == -1){
+		cv_broadcast(parent->wait, parent->wait_lock);
 	}
 
+	// once our own lock is dropped the parent may reap us, so touch nothing of ours after
+	lock_release(proc->wait_lock);
+	lock_release(parent->wait_lock);
+
 	return;
 }
 
@@ -309,9 +406,106 @@ proc_exit(struct proc *proc, int exitcode)
 void 
 proc_destroy(struct proc *proc)
 {
+	// once out of the table under the reflock, no new lookup can find us
+	pid_acquire_lock(pids);
+	spinlock_acquire(&proc_reflock);
 	pid_remove_proc(pids, proc->pid);
-	kfree(proc->p_name);
-	kfree(proc);
+	spinlock_release(&proc_reflock);
+	pid_release_lock(pids);
+
+	// drop the table's reference
+	proc_release(proc);
+}
+
+struct proc *
+proc_lookup(int pid)
+{
+	spinlock_acquire(&proc_reflock);
+	struct proc *proc = pid_get_proc(pids, pid);
+	if(proc != NULL){
+		proc->p_refcount++;
+	}
+	spinlock_release(&proc_reflock);
+	return proc;
+}
+
+void
+proc_release(struct proc *proc)
+{
+	spinlock_acquire(&proc_reflock);
+	KASSERT(proc->p_refcount > 0);
+	bool last = --proc->p_refcount == 0;
+	spinlock_release(&proc_reflock);
+
+	if(last){
+		spinlock_cleanup(&proc->p_lock);
+		lock_destroy(proc->wait_lock);
+		kfree(proc->p_name);
+		kfree(proc);
+	}
+}
+
+int
+proc_wait(struct proc *proc, int pid, bool block, struct proc **child_ret)
+{
+	lock_acquire(proc->wait_lock);
+
+	struct proc *child = NULL;
+	if(pid != -1){
+		// only we can destroy our own children, so the child stays put once found
+		if(list_find(proc->children, &pid, proc_pidcmp) == NULL){
+			lock_release(proc->wait_lock);
+			return pid_get_proc(pids, pid) == NULL ? ESRCH : ECHILD;
+		}
+		child = pid_get_proc(pids, pid);
+		KASSERT(child != NULL);
+	} else if(list_isempty(proc->children)){
+		lock_release(proc->wait_lock);
+		return ECHILD;
+	}
+
+	/* indicate which child we are waiting on */
+	proc->waitpid = pid;
+
+	while(true){
+		if(child == NULL && !list_isempty(proc->zombies)){
+			// any child will do; take the one that exited first
+			child = list_front(proc->zombies);
+		}
+		if(child != NULL && child->exited){
+			break;
+		}
+		if(!block){
+			proc->waitpid = -1;
+			lock_release(proc->wait_lock);
+			*child_ret = NULL;
+			return 0;
+		}
+		cv_wait(proc->wait, proc->wait_lock);
+	}
+
+	// no longer waiting
+	proc->waitpid = -1;
+	lock_release(proc->wait_lock);
+
+	// an exited child stays on our lists until we reap it
+	*child_ret = child;
+	return 0;
+}
+
+void
+proc_reap(struct proc *proc, struct proc *child)
+{
+	KASSERT(child->exited);
+
+	// remove references from our lists; nobody else can reach the child after this
+	lock_acquire(proc->wait_lock);
+	list_remove(proc->zombies, child, proc_ptrcmp);
+	kfree(list_remove(proc->children, &child->pid, proc_pidcmp));
+	lock_release(proc->wait_lock);
+
+	// clean up the child process
+	proc_destroy(child);
 }
 
 /*
@@ -361,11 +555,18 @@ proc_create_runprogram(const char *name, int *error)
 	}
 	spinlock_release(&curproc->p_lock);
 
-	// create the new process as a fork of kproc
-	newproc->parent = 0;
+	// create the new process as a fork of kproc; menu threads may share it
 	int *pid = kmalloc(sizeof(int));
+	if(pid == NULL){
+		*error = ENOMEM;
+		proc_exit(newproc, 0);
+		return NULL;
+	}
 	*pid = newproc->pid;
+	lock_acquire(kproc->wait_lock);
 	list_push_back(kproc->children, pid); 
+	newproc->parent = 0;
+	lock_release(kproc->wait_lock);
 
 	return newproc;
 }
@@ -395,35 +596,26 @@ proc_create_fork(const char *name, struct proc *parent, int *error){
 		VOP_INCREF(parent->p_cwd);
 		proc->p_cwd = parent->p_cwd;
 	}
-  if(parent->files != NULL)
-  {
-    proc->files = hashtable_create();
-    if(proc->files == NULL) {
-      *error = ENOMEM;
-      proc_exit(proc, 0);
-    }
-
-    for(int i = 3; i < parent->next_fd; i++)
-    {
-      char* fdkey = int_to_byte_string(i);
-      fcblock *controlblock = (fcblock*) hashtable_find(parent->files, fdkey, strlen(fdkey));
-      if (controlblock != NULL)
-      {
-        fcblock *newcontrolblock = kmalloc(sizeof(fcblock));
-        if (newcontrolblock == NULL)
-        {
-          *error = ENOMEM;
-          proc_exit(proc, 0);
-        }
-        newcontrolblock->node = controlblock->node;
-        newcontrolblock->offset = controlblock->offset;
-        newcontrolblock->permissions = controlblock->permissions;
-        hashtable_add(proc->files, fdkey, strlen(fdkey), newcontrolblock);
-      }
-    }
-  }
 	spinlock_release(&parent->p_lock);
 
+	// share the parent's open files; the parent only needs to be read
+	rwlock_acquire_read(parent->files_lock);
+	unsigned nfiles = array_num(parent->files);
+	if(array_setsize(proc->files, nfiles)){
+		rwlock_release_read(parent->files_lock);
+		*error = ENOMEM;
+		proc_exit(proc, 0);
+		return NULL;
+	}
+	for(unsigned i = 0; i < nfiles; i++){
+		fcblock *ctrl = array_get(parent->files, i);
+		if(ctrl != NULL){
+			fcblock_incref(ctrl);
+		}
+		array_set(proc->files, i, ctrl);
+	}
+	rwlock_release_read(parent->files_lock);
+
 	// set parent and child relationship
 	int *pid = kmalloc(sizeof(pid));
 	if(pid == NULL){
@@ -433,8 +625,10 @@ proc_create_fork(const char *name, struct proc *parent, int *error){
 	}
 
 	*pid = proc->pid;
+	lock_acquire(parent->wait_lock);
 	list_push_back(parent->children, pid);
 	proc->parent = parent->pid;
+	lock_release(parent->wait_lock);
 
 	return proc;
 }
@@ -498,51 +692,65 @@ proc_remthread(struct thread *t)
  * Returns 0 on success or an error.
  */
 int 
-proc_addfile(struct proc *proc, char* fdkey, void* controlblock)
+proc_addfile(struct proc *proc, struct filecontrolblock *ctrl, int minfd, int *fd_ret)
 {
-	if(hashtable_getsize(proc->files) >= OPEN_MAX){
+	KASSERT(minfd >= 0);
+
+	rwlock_acquire_write(proc->files_lock);
+
+	// lowest free slot, growing the table by one if there is none
+	unsigned fd;
+	unsigned num = array_num(proc->files);
+	for(fd = minfd; fd < num; fd++){
+		if(array_get(proc->files, fd) == NULL){
+			break;
+		}
+	}
+	if(fd >= OPEN_MAX){
+		rwlock_release_write(proc->files_lock);
 		return EMFILE;
 	}
-	int err = hashtable_add(proc->files, fdkey, strlen(fdkey), controlblock);
-	return err;
+	if(fd >= num){
+		if(array_setsize(proc->files, fd + 1)){
+			rwlock_release_write(proc->files_lock);
+			return ENOMEM;
+		}
+		for(unsigned i = num; i < fd; i++){
+			array_set(proc->files, i, NULL);
+		}
+	}
+	array_set(proc->files, fd, ctrl);
+
+	rwlock_release_write(proc->files_lock);
+
+	*fd_ret = fd;
+	return 0;
 }
 
-static
-void 
-proc_remlist(struct list *list, int val)
+struct filecontrolblock *
+proc_getfile(struct proc *proc, int fd)
 {
-	if(list_isempty(list)){
-		return;
-	}
-
-	int *first = list_front(list);
-	list_pop_front(list);
-	if(*first == val || list_isempty(list)){
-		return;
-	}
+	struct filecontrolblock *ctrl = NULL;
 
-	// rotate through the list until we find the head again, or find the fd
-	list_push_back(list, first);
-	int *cur = list_front(list);
-	while(*cur != *first){
-		list_pop_front(list);
-		if(*cur == val){
-			return;
-		}
-		list_push_back(list, cur);
-		cur = list_front(list);
+	rwlock_acquire_read(proc->files_lock);
+	if(fd >= 0 && (unsigned) fd < array_num(proc->files)){
+		ctrl = array_get(proc->files, fd);
 	}
+	rwlock_release_read(proc->files_lock);
+	return ctrl;
 }
 
-void
+struct filecontrolblock *
 proc_remfile(struct proc *proc, int fd){
-  hashtable_remove(proc->files, (char *) fd, 1);
-	//proc_remlist(proc->files, fd);
-}
+	struct filecontrolblock *ctrl = NULL;
 
-void
-proc_remchild(struct proc *proc, int child){
-	proc_remlist(proc->children, child);
+	rwlock_acquire_write(proc->files_lock);
+	if(fd >= 0 && (unsigned) fd < array_num(proc->files)){
+		ctrl = array_get(proc->files, fd);
+		array_set(proc->files, fd, NULL);
+	}
+	rwlock_release_write(proc->files_lock);
+	return ctrl;
 }
 
 /*
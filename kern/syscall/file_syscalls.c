@@ -7,148 +7,323 @@
 #include <current.h>
 #include <uio.h>
 #include <kern/iovec.h>
+#include <limits.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <addrspace.h>
+
+fcblock *fcblock_create(struct vnode *node, int permissions)
+{
+  fcblock *ctrl = kmalloc(sizeof(fcblock));
+  if (ctrl == NULL)
+  {
+    return NULL;
+  }
+  ctrl->offset_lock = lock_create("fcblock");
+  if (ctrl->offset_lock == NULL)
+  {
+    kfree(ctrl);
+    return NULL;
+  }
+  ctrl->node = node;
+  ctrl->offset = 0;
+  ctrl->permissions = permissions;
+  ctrl->refcount = 1;
+  return ctrl;
+}
+
+void fcblock_incref(fcblock *ctrl)
+{
+  lock_acquire(ctrl->offset_lock);
+  ctrl->refcount++;
+  lock_release(ctrl->offset_lock);
+}
+
+void fcblock_decref(fcblock *ctrl)
+{
+  lock_acquire(ctrl->offset_lock);
+  KASSERT(ctrl->refcount > 0);
+  ctrl->refcount--;
+  bool last = ctrl->refcount == 0;
+  lock_release(ctrl->offset_lock);
+
+  if (last)
+  {
+    vfs_close(ctrl->node);
+    lock_destroy(ctrl->offset_lock);
+    kfree(ctrl);
+  }
+}
+
+// opens the console on whichever of stdin, stdout and stderr aren't open yet
+static
+void open_console(struct proc *cur)
+{
+  for (int fd = 0; fd < FD_FIRST_FREE; fd++)
+  {
+    if (proc_getfile(cur, fd) != NULL)
+    {
+      continue;
+    }
+    char path[] = "con:";
+    struct vnode *node;
+    if (vfs_open(path, O_RDWR, 0, &node))
+    {
+      return;
+    }
+    fcblock *ctrl = fcblock_create(node, O_RDWR);
+    if (ctrl == NULL)
+    {
+      vfs_close(node);
+      return;
+    }
+    int got;
+    if (proc_addfile(cur, ctrl, fd, &got) || got != fd)
+    {
+      // raced with another open; not worth unwinding
+      fcblock_decref(ctrl);
+      return;
+    }
+  }
+}
+
+// looks up an open file, binding the standard descriptors to the console on first use
+static
+fcblock *get_file(struct proc *cur, int fd)
+{
+  fcblock *ctrl = proc_getfile(cur, fd);
+  if (ctrl == NULL && fd >= 0 && fd < FD_FIRST_FREE)
+  {
+    open_console(cur);
+    ctrl = proc_getfile(cur, fd);
+  }
+  return ctrl;
+}
 
 int sys_open(const char *filename, int flags, int* error)
 {
   *error = 0;
-  fcblock *ctrl = (fcblock*) 
-        kmalloc(sizeof(fcblock));
-  if (ctrl == NULL)
+  struct proc *cur = curproc;
+  if(cur == NULL){
+		panic("User processes must always have a process control block.");
+	}
+  char* name = kstrdup(filename);
+  if (name == NULL)
   {
     *error = ENOMEM;
     return -1;
   }
-  char* name = kstrdup(filename);
-  int vfsresult = vfs_open(name, flags, 0, &(ctrl->node));
+  struct vnode *node;
+  int vfsresult = vfs_open(name, flags, 0, &node);
+  kfree(name);
   if (vfsresult != 0)
   {
     *error = vfsresult;
     return -1;
   }
-  ctrl->offset = 0;
-  ctrl->permissions = flags & O_ACCMODE;
-  struct proc *cur = curproc;
-  if(cur == NULL){
-		panic("User processes must always have a process control block.");
-	}
-  int fd = cur->next_fd;
-  char* fdkey = int_to_byte_string(fd);
-  int addresult = proc_addfile(cur, fdkey, ctrl);
+  fcblock *ctrl = fcblock_create(node, flags & O_ACCMODE);
+  if (ctrl == NULL)
+  {
+    vfs_close(node);
+    *error = ENOMEM;
+    return -1;
+  }
+  int fd;
+  int addresult = proc_addfile(cur, ctrl, FD_FIRST_FREE, &fd);
   if (addresult != 0)
   {
+    fcblock_decref(ctrl);
     *error = addresult;
     return -1;
   }
-  (cur->next_fd)++;
   return fd;
 }
 
-ssize_t sys_read(int fd, void *buf, size_t buflen, int* error)
+// iovec arrays up to this size are copied in on the stack
+#define FILE_IOV_ONSTACK 8
+
+/* Common body of the read and write calls: moves data straight between the file and the user's
+ * buffers, described by the kernel copy of their iovecs, so the only copy made is the one
+ * uiomove does between the file's buffers and user memory. The buffers' pages are loaded from
+ * the executable beforehand, since uiomove runs with file system locks held. A negative pos
+ * means the file's own offset, which is then advanced. */
+static
+ssize_t file_uio(int fd, struct iovec *iov, int iovcnt, off_t pos, enum uio_rw rw, int *error)
 {
   struct proc *cur = curproc;
-  *error = 0; 
   if(cur == NULL)
   {
 		panic("User processes must always have a process control block.");
 	}
-  char* fdkey = int_to_byte_string(fd);
-  fcblock *ctrl = (fcblock*) hashtable_find(cur->files, fdkey, strlen(fdkey));
-  kfree(fdkey);
-  if(ctrl == NULL)
+  fcblock *ctrl = get_file(cur, fd);
+  if (ctrl == NULL)
+  {
+    *error = EBADF;
+    return -1;
+  }
+  int wanted = rw == UIO_READ ? O_RDONLY : O_WRONLY;
+  if (ctrl->permissions != wanted && ctrl->permissions != O_RDWR)
+  {
+    *error = EBADF;
+    return -1;
+  }
+
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++)
   {
-    if (fd < 3)
+    if (total + iov[i].iov_len < total)
     {
-      int last_fd = cur->next_fd;
-      cur->next_fd = 0;
-      sys_open("con:", O_RDWR, error);
-      sys_open("con:", O_RDWR, error);
-      sys_open("con:", O_RDWR, error);
-      cur->next_fd = last_fd;
-      fdkey = int_to_byte_string(fd);
-      ctrl = (fcblock*) hashtable_find(cur->files, fdkey, strlen(fdkey));
-      kfree(fdkey);
+      *error = EINVAL;
+      return -1;
+    }
+    total += iov[i].iov_len;
+  }
+
+  struct uio uio;
+  uio.uio_iov = iov;
+  uio.uio_iovcnt = iovcnt;
+  uio.uio_resid = total;
+  uio.uio_rw = rw;
+  uio.uio_space = proc_getas();
+  // kernel threads (the menu's file tests) have no address space and pass kernel buffers
+  uio.uio_segflg = uio.uio_space == NULL ? UIO_SYSSPACE : UIO_USERSPACE;
+
+  if (uio.uio_space != NULL)
+  {
+    for (int i = 0; i < iovcnt; i++)
+    {
+      int result = as_prefault(uio.uio_space, (vaddr_t) iov[i].iov_ubase, iov[i].iov_len);
+      if (result)
+      {
+        *error = result;
+        return -1;
+      }
     }
-    else
+  }
+
+  bool positional = pos >= 0;
+  if (positional)
+  {
+    if (!VOP_ISSEEKABLE(ctrl->node))
     {
-      *error = EBADF;
+      *error = ESPIPE;
       return -1;
     }
+    uio.uio_offset = pos;
   }
-  if(ctrl->permissions != O_RDONLY && ctrl->permissions != O_RDWR)
+  else
   {
-    *error = EBADF;
-    return -1;
+    lock_acquire(ctrl->offset_lock);
+    uio.uio_offset = ctrl->offset;
   }
-  struct iovec iov;
-  struct uio reader;
-  uio_kinit(&iov, &reader, buf, buflen, ctrl->offset, UIO_READ);
-  int vop_result = VOP_READ(ctrl->node, &reader);
-  if (vop_result != 0)
+
+  int result = rw == UIO_READ ? VOP_READ(ctrl->node, &uio) : VOP_WRITE(ctrl->node, &uio);
+  ssize_t moved = total - uio.uio_resid;
+  if (!positional)
+  {
+    ctrl->offset += moved;
+    lock_release(ctrl->offset_lock);
+  }
+
+  // a partial transfer still counts; only report the error if nothing moved
+  if (result != 0 && moved == 0)
   {
-    *error = EIO;
+    *error = result;
     return -1;
   }
-  int result = reader.uio_offset - ctrl->offset;
-  ctrl->offset = reader.uio_offset;
-  return result;
+  *error = 0;
+  return moved;
 }
 
-ssize_t sys_write(int fd, const void *buf, size_t nbytes, int* error)
+static
+ssize_t file_iov(int fd, userptr_t useriov, int iovcnt, enum uio_rw rw, int *error)
 {
-  struct proc *cur = curproc;
-  *error=0;
-  if(cur == NULL)
+  struct iovec onstack[FILE_IOV_ONSTACK];
+  struct iovec *iov = onstack;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX)
   {
-		panic("User processes must always have a process control block.");
-	}
-  char* fdkey = int_to_byte_string(fd);
-  fcblock *ctrl = (fcblock*) hashtable_find(cur->files, fdkey, strlen(fdkey));
-  kfree(fdkey);
-  if(ctrl == NULL)
+    *error = EINVAL;
+    return -1;
+  }
+  if (iovcnt > FILE_IOV_ONSTACK)
   {
-    if (fd < 3)
-    {
-      int last_fd = cur->next_fd;
-      cur->next_fd = 0;
-      sys_open("con:", O_RDWR, error);
-      sys_open("con:", O_RDWR, error);
-      sys_open("con:", O_RDWR, error);
-      cur->next_fd = last_fd;
-      fdkey = int_to_byte_string(fd);
-      ctrl = (fcblock*) hashtable_find(cur->files, fdkey, strlen(fdkey));
-      kfree(fdkey);
-    }
-    else
+    iov = kmalloc(iovcnt * sizeof(struct iovec));
+    if (iov == NULL)
     {
-      *error = EBADF;
+      *error = ENOMEM;
       return -1;
     }
   }
-  if(ctrl->permissions != O_WRONLY && ctrl->permissions != O_RDWR)
+
+  ssize_t result;
+  *error = copyin(useriov, iov, iovcnt * sizeof(struct iovec));
+  if (*error)
   {
-    *error = EBADF;
-    return -1;
+    result = -1;
   }
-  void* bufcpy = kmalloc(nbytes);
-  if (bufcpy == NULL)
+  else
   {
-    *error = ENOMEM;
+    result = file_uio(fd, iov, iovcnt, -1, rw, error);
+  }
+
+  if (iov != onstack)
+  {
+    kfree(iov);
+  }
+  return result;
+}
+
+ssize_t sys_readv(int fd, userptr_t iov, int iovcnt, int *error)
+{
+  return file_iov(fd, iov, iovcnt, UIO_READ, error);
+}
+
+ssize_t sys_writev(int fd, userptr_t iov, int iovcnt, int *error)
+{
+  return file_iov(fd, iov, iovcnt, UIO_WRITE, error);
+}
+
+ssize_t sys_read(int fd, void *buf, size_t buflen, int* error)
+{
+  struct iovec iov;
+  iov.iov_ubase = (userptr_t) buf;
+  iov.iov_len = buflen;
+  return file_uio(fd, &iov, 1, -1, UIO_READ, error);
+}
+
+ssize_t sys_write(int fd, const void *buf, size_t nbytes, int* error)
+{
+  struct iovec iov;
+  iov.iov_ubase = (userptr_t) buf;
+  iov.iov_len = nbytes;
+  return file_uio(fd, &iov, 1, -1, UIO_WRITE, error);
+}
+
+ssize_t sys_pread(int fd, userptr_t buf, size_t buflen, off_t pos, int *error)
+{
+  struct iovec iov;
+  if (pos < 0)
+  {
+    *error = EINVAL;
     return -1;
   }
-  memcpy(bufcpy, buf, nbytes);
+  iov.iov_ubase = buf;
+  iov.iov_len = buflen;
+  return file_uio(fd, &iov, 1, pos, UIO_READ, error);
+}
+
+ssize_t sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t pos, int *error)
+{
   struct iovec iov;
-  struct uio writer;
-  uio_kinit(&iov, &writer, bufcpy, nbytes, ctrl->offset, UIO_WRITE);
-  int vop_result = VOP_WRITE(ctrl->node, &writer);
-  if (vop_result != 0)
+  if (pos < 0)
   {
-    *error = EIO;
+    *error = EINVAL;
     return -1;
   }
-  int result = writer.uio_offset - ctrl->offset;
-  ctrl->offset = writer.uio_offset;
-  kfree(bufcpy);
-  return result;
+  iov.iov_ubase = buf;
+  iov.iov_len = nbytes;
+  return file_uio(fd, &iov, 1, pos, UIO_WRITE, error);
 }
 
 int sys_close(int fd, int* error)
@@ -163,16 +338,12 @@ int sys_close(int fd, int* error)
 int close_from_process(int fd, int *error, struct proc *p)
 {
   *error = 0;
-  char* fdkey = int_to_byte_string(fd);
-  fcblock *ctrl = (fcblock*) hashtable_remove(p->files, fdkey, strlen(fdkey));
-  kfree(fdkey);
+  fcblock *ctrl = proc_remfile(p, fd);
   if (ctrl == NULL)
   {
     *error = EBADF;
     return -1;
   }
-  vfs_close(ctrl->node);
-  kfree(ctrl);
+  fcblock_decref(ctrl);
   return 0;
 }
-
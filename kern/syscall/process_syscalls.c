@@ -30,6 +30,7 @@
 #include <types.h>
 #include <current.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <proc.h>
 #include <copyinout.h>
 #include <addrspace.h>
@@ -42,11 +43,8 @@ int sys_getpid(void){
 		panic("User processes must always have a process control block.");
 	}
 
-	pid_acquire_lock(pids);
-	int pid = curproc->pid;
-	pid_release_lock(pids);
-
-	return pid;
+	// a process's own pid never changes; no lock needed
+	return cur->pid;
 }
 
 static 
@@ -61,8 +59,6 @@ int wrap_forked_process(void *data, unsigned long num){
 int sys_fork(struct trapframe *tf, int *error){
 	struct thread *cur = curthread;
 
-	pid_acquire_lock(pids);
-
 	int err = 0;
 
 	// fork the process control block
@@ -84,21 +80,16 @@ int sys_fork(struct trapframe *tf, int *error){
 	// fork the new thread for the new process
 	thread_fork("TCB FORK", newproc, wrap_forked_process, onheap, 0);
 
-	pid_release_lock(pids);
-
 	*error = 0;
 	return newproc->pid;
 }
 
-int sys_waitpid(int pid, userptr_t status, int options){
+int sys_waitpid(int pid, userptr_t status, int options, int *retval){
 	struct proc *cur = curproc;
 	int err = 0;
 
-	pid_acquire_lock(pids);
-
 	// check that the options are valid
-	if(options != 0){
-		pid_release_lock(pids);
+	if((options & ~WNOHANG) != 0){
 		return EINVAL;
 	}
 
@@ -107,53 +98,41 @@ int sys_waitpid(int pid, userptr_t status, int options){
 	if(status != NULL){
 		err = copyin(status, &test, sizeof(int));
 		if(err){
-			pid_release_lock(pids);
 			return err;
 		}
 	}
 
-	struct proc *child = pid_get_proc(pids, pid);
-	if(child == NULL){
-		pid_release_lock(pids);
-		return ESRCH;
-	}
-
-	if(child->parent != cur->pid){
-		pid_release_lock(pids);
-		return ECHILD;
+	struct proc *child = NULL;
+	err = proc_wait(cur, pid, (options & WNOHANG) == 0, &child);
+	if(err){
+		return err;
 	}
-
-	/* indicate which child we are waiting on */
-	cur->waitpid = pid;
-
-	while(!child->exited){
-		cv_wait(cur->wait, pids->lock);
+	if(child == NULL){
+		// WNOHANG, and nothing has exited yet
+		if(retval != NULL){
+			*retval = 0;
+		}
+		return 0;
 	}
 
-	// no longer waiting
-	cur->waitpid = -1;
-
-	// copy out the exit val
+	// copy out the exit val; the child is only reaped once it has been delivered
 	if(status != NULL){
-		int exit_val = child->exit_val;
-		err = copyout(&exit_val, status, sizeof(int));
+		err = copyout(&child->exit_val, status, sizeof(int));
+		if(err){
+			return err;
+		}
 	}
 
-	// clean up the child process
-	proc_destroy(child);
-
-	// remove reference from our children list
-	proc_remchild(cur, pid);
-
-	pid_release_lock(pids);
-
-	return err;
+	if(retval != NULL){
+		*retval = child->pid;
+	}
+	proc_reap(cur, child);
+	return 0;
 }
 
 void sys__exit(int exitcode){
 	struct thread *cur = curthread;
 
-	pid_acquire_lock(pids);
 	// TODO: lock file-table
 
 	struct proc *proc = cur->t_proc;
@@ -162,8 +141,6 @@ void sys__exit(int exitcode){
 
 	proc_exit(proc, exitcode);
 
-	pid_release_lock(pids);
-
 	thread_exit();
 
 	panic("SYS__exit should not return!!! braaaiiiinnnsss");
@@ -5,6 +5,9 @@
 #include <kern/errno.h>
 #include <thread.h>
 #include <addrspace.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <swap.h>
 
 
 int sys_sbrk(intptr_t amount, int *error) {
@@ -21,6 +24,13 @@ int sys_sbrk(intptr_t amount, int *error) {
 		if (as->heap_end + amount >= as->heap_start) {
 			prev = as->heap_end;
 			as->heap_end += amount;
+
+			// give back the pages the heap no longer covers, along with their swap
+			vaddr_t page = ROUNDUP(as->heap_end, PAGE_SIZE);
+			for (; page < (vaddr_t) prev; page += PAGE_SIZE) {
+				vm_tlbshootdown_page(as, page);
+				pagetable_remove(as->pages, page, as->pid);
+			}
 			return prev;
 		} else {
 			*error = EINVAL;
@@ -28,6 +38,16 @@ int sys_sbrk(intptr_t amount, int *error) {
 		}
 	} else { //amount > 0
 		if(as->heap_end + amount < as->stack_base) { 
+			// refuse growth that could never be backed by swap, rather than fault later
+			unsigned int total, reserved, used;
+			swap_getstats(&total, &reserved, &used);
+			unsigned int npages = (ROUNDUP(as->heap_end + amount, PAGE_SIZE) -
+				ROUNDUP(as->heap_end, PAGE_SIZE)) / PAGE_SIZE;
+			if (npages > total - reserved) {
+				*error = ENOMEM;
+				return -1;
+			}
+
 			prev = as->heap_end;
 			as->heap_end += amount;
 			return prev;
@@ -7,6 +7,7 @@ Unit tests for multi-process support.
 #include <types.h>
 #include <current.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <limits.h>
 #include <clock.h>
 #include <thread.h>
@@ -15,22 +16,19 @@ Unit tests for multi-process support.
 #include <../arch/mips/include/trapframe.h>
 
 int test_processes(int nargs, char** args);
-void test_pid_tree(void);
+void test_pid_table(void);
 int thread_helper(void *data, unsigned long num);
 
-void verify_subtree_counts(struct pid_tree *tree);
-void verify_ordering(struct pid_tree *tree);
-void verify_number(struct pid_tree *tree, int goal);
-int get_max(struct pid_tree *tree);
-int get_min(struct pid_tree *tree);
+void verify_ordering(struct pid_table *table);
+void verify_number(struct pid_table *table, int goal);
 
 int test__exit(int nargs, char** args);
 
 int test_exit_child_first(void);
 int test_exit_parent_first(void);
 
-void verify_proc(struct pid_tree *pids, struct proc *proc);
-void verify_all_procs(struct pid_tree *tree);
+void verify_proc(struct pid_table *pids, struct proc *proc);
+void verify_all_procs(struct pid_table *table);
 
 int test_fork(int nargs, char** args);
 void fork_pcb(void);
@@ -43,10 +41,12 @@ void wait_for_non_exist(void);
 void bad_options(void);
 void bad_status_fail_fast(void);
 void run_waitpid(void);
+void wait_any_nohang(void);
+int wait_any_child_thread(void *data, unsigned long num);
 int wait_parent_thread(void *data, unsigned long num);
 int wait_child_thread(void *data, unsigned long num);
 
-struct pid_tree *tree;
+struct pid_table *table;
 
 int test_wait(int nargs, char** args){
 	(void) nargs;
@@ -57,6 +57,7 @@ int test_wait(int nargs, char** args){
 	bad_options();
 	bad_status_fail_fast();
 	run_waitpid();
+	wait_any_nohang();
 
 	return 0;
 }
@@ -76,12 +77,12 @@ int test__exit(int nargs, char** args){
 
 	// since methods are embedded, this HAS to modify and test against the live pid directory
 
-	// verify the tree of live processes (!) 
+	// verify the table of live processes (!) 
 	pid_acquire_lock(pids);
 	verify_all_procs(pids);
 	pid_release_lock(pids);
 
-	kprintf("The live process tree verified as correct.\n");
+	kprintf("The live process table verified as correct.\n");
 
 	// verify the live kproc (!)
 	pid_acquire_lock(pids);
@@ -107,73 +108,70 @@ int test_processes(int nargs, char** args){
 	(void) nargs;
 	(void) args;
 
-	test_pid_tree();
+	test_pid_table();
 
 	return 0;
 }
 
-void test_pid_tree(void){
+void test_pid_table(void){
 
-	tree = pid_create_tree(NULL);
+	table = pid_create_table(NULL);
 
-	KASSERT(tree != NULL);
-	KASSERT(tree->parent == NULL);
-	verify_subtree_counts(tree);
-	verify_number(tree, 0);
+	KASSERT(table != NULL);
+	verify_ordering(table);
+	verify_number(table, 0);
 
-	kprintf("Pid directory tree successfully initialized.\n");
+	kprintf("Pid table successfully initialized.\n");
 
-	// add processes to the tree, verifying at each one that we can retrieve it
+	// add processes to the table, verifying at each one that we can retrieve it
 	const int num_test = 257;
 	int pids[num_test];
 	for(int i = 0; i < num_test; i++){
 		struct proc *proc;
 		proc = kmalloc(sizeof(*proc));
-		pid_acquire_lock(tree);
-		int pid = pid_allocate(tree, proc);
+		pid_acquire_lock(table);
+		int pid = pid_allocate(table, proc);
 		pids[i] = pid;
-		pid_release_lock(tree);
+		pid_release_lock(table);
 
-		pid_acquire_lock(tree);
-		struct proc *ret = pid_get_proc(tree, pid);
+		pid_acquire_lock(table);
+		struct proc *ret = pid_get_proc(table, pid);
 		KASSERT(ret == proc);
-		pid_release_lock(tree);
+		pid_release_lock(table);
 	}
 
-	verify_subtree_counts(tree);
-	verify_ordering(tree);
-	verify_number(tree, 257);
+	verify_ordering(table);
+	verify_number(table, 257);
 
 	kprintf("Adding and retrieving processes by a single thread is successful.\n");
 
-	KASSERT(!pid_destroy_tree(tree));
+	KASSERT(!pid_destroy_table(table));
 
-	kprintf("Attempting to destroy a tree with active processes failed.\n");
+	kprintf("Attempting to destroy a table with active processes failed.\n");
 
 	for(int i = 0; i < num_test; i++){
-		pid_acquire_lock(tree);
-		pid_remove_proc(tree, pids[i]);
-		pid_release_lock(tree);
+		pid_acquire_lock(table);
+		pid_remove_proc(table, pids[i]);
+		pid_release_lock(table);
 	}
 
-	verify_subtree_counts(tree);
-	verify_ordering(tree);
-	verify_number(tree, 0);
+	verify_ordering(table);
+	verify_number(table, 0);
 
 	kprintf("Removing processes by a single thread is successful.\n");
 
-	KASSERT(pid_destroy_tree(tree));
-	tree = NULL;
+	KASSERT(pid_destroy_table(table));
+	table = NULL;
 
-	kprintf("Destroying an empty tree was successful.\n");
+	kprintf("Destroying an empty table was successful.\n");
 
-	KASSERT(!pid_destroy_tree(tree));
+	KASSERT(!pid_destroy_table(table));
 
 	kprintf("Attempting to destroy a NULL pointer failed.\n");
 
 	struct proc *proc;
 	proc = kmalloc(sizeof(*proc));
-	tree = pid_create_tree(proc);
+	table = pid_create_table(proc);
 
 	const int num_threads = 7;
 	struct thread *threads[num_threads];
@@ -184,19 +182,18 @@ void test_pid_tree(void){
 		KASSERT(thread_join(threads[i]) == 1);
 	}
 
-	verify_ordering(tree);
-	verify_subtree_counts(tree);
-	verify_number(tree, 1);
+	verify_ordering(table);
+	verify_number(table, 1);
 
 	kprintf("Adding and removing processes with multiple threads succeeds.\n");
 
-	struct proc *kproc = pid_remove_proc(tree, 0);
+	struct proc *kproc = pid_remove_proc(table, 0);
 	KASSERT(kproc == proc);
 
 	kprintf("Removing the initial kernel process at pre-determined pid = 0 succeeds.\n");
 
-	KASSERT(pid_destroy_tree(tree));
-	tree = NULL;
+	KASSERT(pid_destroy_table(table));
+	table = NULL;
 }
 
 int thread_helper(void *data, unsigned long num){
@@ -210,126 +207,70 @@ int thread_helper(void *data, unsigned long num){
 		struct proc *proc;
 		proc = kmalloc(sizeof(*proc));
 
-		// add the process to the tree, locking only for the add operation
-		pid_acquire_lock(tree);
-		int pid = pid_allocate(tree, proc);
+		// add the process to the table, locking only for the add operation
+		pid_acquire_lock(table);
+		int pid = pid_allocate(table, proc);
 		KASSERT(pid >= PID_MIN);
 		KASSERT(pid <= PID_MAX);
-		pid_release_lock(tree);
+		pid_release_lock(table);
 
-		// retrieve the process without changing the tree; verify that the tree is valid
-		pid_acquire_lock(tree);
-		struct proc *get = pid_get_proc(tree, pid);
+		// retrieve the process without changing the table; verify that the table is valid
+		pid_acquire_lock(table);
+		struct proc *get = pid_get_proc(table, pid);
 		KASSERT(get == proc);
-		verify_ordering(tree);
-		verify_subtree_counts(tree);
-		pid_release_lock(tree);
+		verify_ordering(table);
+		pid_release_lock(table);
 
-		// remove the process from the tree
-		pid_acquire_lock(tree);
-		struct proc *ret = pid_remove_proc(tree, pid);
+		// remove the process from the table
+		pid_acquire_lock(table);
+		struct proc *ret = pid_remove_proc(table, pid);
 		KASSERT(ret == proc);
-		verify_ordering(tree);
-		verify_subtree_counts(tree);
-		pid_release_lock(tree);
+		verify_ordering(table);
+		pid_release_lock(table);
 	}
 
 	return 1;
 }
 
-void verify_subtree_counts(struct pid_tree *tree){
-	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(tree->subtrees[i] != NULL){
-			KASSERT(tree->subtree_sizes[i] > 0);
-			verify_number(tree->subtrees[i], tree->subtree_sizes[i]);
-			verify_subtree_counts(tree->subtrees[i]);
-		}
-	}
-}
-
-void verify_number(struct pid_tree *tree, int goal){
+void verify_number(struct pid_table *table, int goal){
 	int count = 0;
 	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(tree->local_procs[i] != NULL){
-			KASSERT(tree->local_pids[i] != -1);
-			count++;
-		} if(tree->subtrees[i] == NULL){
-			KASSERT(tree->subtree_sizes[i] == 0);
-		} else{
-			verify_number(tree->subtrees[i], tree->subtree_sizes[i]);
-			count += tree->subtree_sizes[i];
+		if(table->leaves[i] == NULL){
+			continue;
 		}
-	}
-	KASSERT(count == goal);
-}
-
-int get_min(struct pid_tree *tree){
-
-	if(tree == NULL){
-		return -1;
-	}
-
-	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(tree->local_pids[i] != -1){
-			return tree->local_pids[i];
-		} else if(get_min(tree->subtrees[i]) > -1){
-			return get_min(tree->subtrees[i]);
-		}
-	}
-
-	return -1;
-}
-
-int get_max(struct pid_tree *tree){
-	if(tree == NULL){
-		return -1;
-	}
-
-	for(int i = PID_DIR_SIZE -1; i >= 0; i--){
-		if(tree->subtrees[i] != NULL){
-			if(get_max(tree->subtrees[i]) > -1){
-				return get_max(tree->subtrees[i]);
-			} else if(tree->local_pids[i] != -1){
-				return tree->local_pids[i];
+		for(int j = 0; j < PID_LEAF_SIZE; j++){
+			if(table->leaves[i][j] != NULL){
+				count++;
 			}
 		}
 	}
-
-	return -1;
+	KASSERT(count == goal);
+	KASSERT(table->count == goal);
 }
 
-void verify_ordering(struct pid_tree *tree){
-	// in one block, pids ordered from left to right
-	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(tree->local_pids[i] != -1){
-			KASSERT(tree->local_pids[i] <= PID_MAX);
-			if(i == 0){
-				KASSERT(tree->local_pids[i] == 0 || tree->local_pids[i] >= PID_MIN);
-			} else{
-				KASSERT(tree->local_pids[i] >= PID_MIN);
-			}
-			for(int j = i + 1; j < PID_DIR_SIZE; j++){
-				if(tree->local_pids[i] != -1 && tree->local_pids[j] != -1){
-					KASSERT(tree->local_pids[i] < tree->local_pids[j]);
-				}
-			}
+void verify_ordering(struct pid_table *table){
+	// only pid 0 (the kernel) may be handed out below PID_MIN
+	KASSERT(table->next_pid >= PID_MIN && table->next_pid <= PID_MAX);
+	if(table->leaves[0] != NULL){
+		for(int pid = 1; pid < PID_MIN; pid++){
+			KASSERT(table->leaves[0][pid] == NULL);
 		}
 	}
 
+	int count = 0;
 	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(tree->subtrees[i] != NULL){
-			verify_ordering(tree->subtrees[i]);
-			int max = get_max(tree->subtrees[i]);
-			int min = get_min(tree->subtrees[i]);
-			if(max != -1){
-				KASSERT(min != -1);
-				KASSERT(tree->local_pids[i] < min);
-				if(i < PID_DIR_SIZE - 1){
-					KASSERT(max < tree->local_pids[i + 1]);
-				}
+		if(table->leaves[i] == NULL){
+			continue;
+		}
+		for(int j = 0; j < PID_LEAF_SIZE; j++){
+			if(table->leaves[i][j] != NULL){
+				KASSERT((i << PID_LEAF_BITS) + j <= PID_MAX);
+				KASSERT(pid_get_proc(table, (i << PID_LEAF_BITS) + j) == table->leaves[i][j]);
+				count++;
 			}
 		}
 	}
+	KASSERT(count == table->count);
 }
 
 int test_exit_child_first(){
@@ -355,9 +296,9 @@ int test_exit_child_first(){
 	list_push_back(parent->children, node);
 
 	// child exits
-	pid_acquire_lock(pids);
 	proc_exit(child, 1);
 
+	pid_acquire_lock(pids);
 	verify_all_procs(pids);
 	pid_release_lock(pids);
 
@@ -370,9 +311,9 @@ int test_exit_child_first(){
 	kprintf("Child exiting before parent remains in existence with correctly stored exit value.\n");
 
 	// parent exits
-	pid_acquire_lock(pids);
-
 	proc_exit(parent, 1);
+
+	pid_acquire_lock(pids);
 	verify_all_procs(pids);
 
 	remain = pid_get_proc(pids, parent_pid);
@@ -419,10 +360,12 @@ int test_exit_parent_first(){
 	pid_acquire_lock(pids);
 
 	verify_all_procs(pids);
+	pid_release_lock(pids);
 
 	proc_exit(parent, 1);
 
-	// since we are still in the lock, the pid is NOT reassigned yet
+	pid_acquire_lock(pids);
+	// since we hold the lock, the pid is NOT reassigned yet
 	struct proc *remain = pid_get_proc(pids, parent_pid);
 	KASSERT(remain == NULL);
 
@@ -441,10 +384,12 @@ int test_exit_parent_first(){
 	remain = pid_get_proc(pids, child_pid);
 
 	KASSERT(remain == child);
+	pid_release_lock(pids);
 
 	proc_exit(child, 1);
 
-	// since we are still in the lock, the pid is NOT reassigned yet
+	pid_acquire_lock(pids);
+	// since we hold the lock, the pid is NOT reassigned yet
 	remain = pid_get_proc(pids, child_pid);
 	KASSERT(remain == NULL);
 
@@ -456,25 +401,24 @@ int test_exit_parent_first(){
 	return 0;
 }
 
-void verify_all_procs(struct pid_tree *pids){
+void verify_all_procs(struct pid_table *pids){
 	if(pids == NULL){
 		return;
 	}
 
-	struct pid_tree *root = pids;
-	while(root->parent != NULL){
-		root = root->parent;
-	}
-
 	for(int i = 0; i < PID_DIR_SIZE; i++){
-		if(pids->local_procs[i] != NULL){
-			verify_proc(root, pids->local_procs[i]);
+		if(pids->leaves[i] == NULL){
+			continue;
+		}
+		for(int j = 0; j < PID_LEAF_SIZE; j++){
+			if(pids->leaves[i][j] != NULL){
+				verify_proc(pids, pids->leaves[i][j]);
+			}
 		}
-		verify_all_procs(pids->subtrees[i]);
 	}
 }
 
-void verify_proc(struct pid_tree *pids, struct proc *proc){
+void verify_proc(struct pid_table *pids, struct proc *proc){
 	KASSERT(pids != NULL);
 	KASSERT(proc != NULL);
 
@@ -498,7 +442,7 @@ void verify_proc(struct pid_tree *pids, struct proc *proc){
 		// running;
 		KASSERT(proc->exit_val == 0);
 		list_assertvalid(proc->children);
-		hashtable_assertvalid(proc->files);
+		KASSERT(array_num(proc->files) <= OPEN_MAX);
 		// not much we can do to check validity of cv, addrspace, vnode
 	}
 
@@ -517,16 +461,12 @@ void verify_proc(struct pid_tree *pids, struct proc *proc){
 
 void fork_pcb(void){
 
-	pid_acquire_lock(pids);
-
 	int err = 0;
 	struct proc *parent = proc_create_runprogram("UNITTEST:PARENT", &err);
 	KASSERT(err == 0);
 
 	struct proc *child = proc_create_fork("UNITTEST:CHILD", parent, &err);
 
-	pid_release_lock(pids);
-
 	KASSERT(err == 0);
 	KASSERT(child->parent == parent->pid);
 	KASSERT(!list_isempty(parent->children));
@@ -537,7 +477,7 @@ void fork_pcb(void){
 	KASSERT(child->p_cwd == parent->p_cwd);
 	// how to assert about the address space contents?
 
-	KASSERT(hashtable_isempty(child->files));
+	KASSERT(array_num(child->files) == 0);
 	KASSERT(list_isempty(child->children));
 	KASSERT(child->exited == false);
 	KASSERT(child->waitpid == -1);
@@ -575,14 +515,12 @@ void wait_for_non_child(void){
 	struct thread *cur = curthread;
 
 	int err = 0;
-	pid_acquire_lock(pids);
 	struct proc *proc = proc_create_runprogram("PROC:TEST", &err);
-	pid_release_lock(pids);
 	KASSERT(err == 0);
 	KASSERT(proc->exited == false);
 	KASSERT(proc->parent != cur->t_proc->pid);
 
-	err = sys_waitpid(proc->pid, NULL, 0);
+	err = sys_waitpid(proc->pid, NULL, 0, NULL);
 	KASSERT(err == ECHILD);
 
 	proc_exit(proc, 0);
@@ -601,7 +539,7 @@ void wait_for_non_exist(void){
 	KASSERT(proc == NULL);
 	pid_release_lock(pids);
 
-	err = sys_waitpid(pid, NULL, 0);
+	err = sys_waitpid(pid, NULL, 0, NULL);
 	KASSERT(err == ESRCH);
 
 	kprintf("... Passed.\n");
@@ -611,14 +549,13 @@ void bad_options(void){
 	kprintf("Attempting to wait using bad options; expecting error.\n");
 
 	int err = 0;
-	pid_acquire_lock(pids);
 	struct proc *proc = proc_create_runprogram("PROC:TEST", &err);
-	pid_release_lock(pids);
 	KASSERT(err == 0);
 	KASSERT(proc->exited == false);
 
-	for(int i = 1; i < 4096; i += 3){
-		err = sys_waitpid(proc->pid, NULL, i);
+	// WNOHANG (1) is the only valid option
+	for(int i = 2; i < 4096; i += 3){
+		err = sys_waitpid(proc->pid, NULL, i, NULL);
 		KASSERT(err == EINVAL);
 	}
 
@@ -632,13 +569,11 @@ void bad_status_fail_fast(void){
 	kprintf("Attempting to wait using a bad status pointer; expecting error.\n");
 
 	int err = 0;
-	pid_acquire_lock(pids);
 	struct proc *proc = proc_create_runprogram("PROC:TEST", &err);
-	pid_release_lock(pids);
 	KASSERT(err == 0);
 	KASSERT(proc->exited == false);
 
-	err = sys_waitpid(proc->pid, (userptr_t) 1, 0);
+	err = sys_waitpid(proc->pid, (userptr_t) 1, 0, NULL);
 	KASSERT(err == EFAULT);
 
 	proc_exit(proc, 0);
@@ -659,17 +594,17 @@ void run_waitpid(void){
 	int pid_id[num_parent_threads];
 	
 	for(int i = 0; i < num_parent_threads; i++){
-		pid_acquire_lock(pids);
 		struct proc *child = proc_create_fork("UNITTEST:PARENT", proc, &err);
 		KASSERT(err == 0); 
 		pid_id[i] = child->pid;
+		pid_acquire_lock(pids);
 		verify_ordering(pids);
-		thread_fork("UNITTEST", child, wait_parent_thread, NULL, pid_id[i]);
 		pid_release_lock(pids);
+		thread_fork("UNITTEST", child, wait_parent_thread, NULL, pid_id[i]);
 	}
 	
 	for(int i = 0; i < num_parent_threads; i++){
-		err = sys_waitpid(pid_id[i], NULL, 0);
+		err = sys_waitpid(pid_id[i], NULL, 0, NULL);
 		if(err){
 			kprintf("Error %d in run_waitpid test.\n", err);
 		}else{
@@ -706,15 +641,15 @@ int wait_parent_thread(void *data, unsigned long num){
 	for(int i = 0; i < num_child_threads; i++){
 		pid_acquire_lock(pids);
 		verify_ordering(pids);
+		pid_release_lock(pids);
 		struct proc *child = proc_create_fork("UNITTEST:CHILD", parent, &err);
 		KASSERT(err == 0); 
 		pid_id[i] = child->pid;
 		thread_fork("UNITTEST:CHILD", child, wait_child_thread, NULL, pid_id[i]);
-		pid_release_lock(pids);
 	}
 	
 	for(int i = 0; i < num_child_threads; i++){
-		err = sys_waitpid(pid_id[i], NULL,  0);
+		err = sys_waitpid(pid_id[i], NULL,  0, NULL);
 		if(err){
 			kprintf("Error %d in wait_parent.\n", err);
 		} else{
@@ -751,3 +686,62 @@ int wait_child_thread(void *data, unsigned long num){
 	// should not return
 	return 0;
 }
+
+void wait_any_nohang(void){
+	kprintf("Testing waitpid() on any child, with and without WNOHANG.\n");
+
+	const int num_children = 4;
+
+	struct proc *proc = curproc;
+
+	int err = 0;
+	int ret = 0;
+
+	int pid_id[num_children];
+
+	for(int i = 0; i < num_children; i++){
+		struct proc *child = proc_create_fork("UNITTEST:CHILD", proc, &err);
+		KASSERT(err == 0);
+		pid_id[i] = child->pid;
+		thread_fork("UNITTEST:CHILD", child, wait_any_child_thread, NULL, i);
+	}
+
+	// the children are all asleep, so nothing is ready yet
+	err = sys_waitpid(-1, NULL, WNOHANG, &ret);
+	KASSERT(err == 0);
+	KASSERT(ret == 0);
+	err = sys_waitpid(pid_id[0], NULL, WNOHANG, &ret);
+	KASSERT(err == 0);
+	KASSERT(ret == 0);
+
+	kprintf("WNOHANG returns immediately while the children run.\n");
+
+	// reap them in whatever order they exit
+	for(int i = 0; i < num_children; i++){
+		err = sys_waitpid(-1, NULL, 0, &ret);
+		KASSERT(err == 0);
+
+		bool found = false;
+		for(int j = 0; j < num_children; j++){
+			if(pid_id[j] == ret){
+				pid_id[j] = -1;
+				found = true;
+			}
+		}
+		KASSERT(found);
+		KASSERT(pid_get_proc(pids, ret) == NULL);
+	}
+
+	kprintf("... Passed.\n");
+}
+
+int wait_any_child_thread(void *data, unsigned long num){
+	(void) data;
+
+	clocksleep(1);
+
+	sys__exit(num);
+
+	// should not return
+	return 0;
+}
@@ -404,3 +404,86 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock test. Every fourth thread writes a consistent
+ * triple of values; the rest check under a read hold that they never
+ * see a half-written one.
+ */
+
+static struct rwlock *testrwlock;
+
+static
+int
+rwlocktestthread(void *junk, unsigned long num)
+{
+	int i;
+	unsigned long v1;
+	(void)junk;
+
+	for (i=0; i<NLOCKLOOPS; i++) {
+		if (num % 4 == 0) {
+			rwlock_acquire_write(testrwlock);
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+			testval3 = num%3;
+			rwlock_release_write(testrwlock);
+		}
+		else {
+			rwlock_acquire_read(testrwlock);
+			v1 = testval1;
+			thread_yield();
+			if (testval2 != v1*v1 || testval3 != v1%3) {
+				kprintf("thread %lu: saw a partial write\n", num);
+				kprintf("Test failed\n");
+				rwlock_release_read(testrwlock);
+				V(donesem);
+				thread_exit();
+			}
+			rwlock_release_read(testrwlock);
+		}
+	}
+	V(donesem);
+	return 0;
+}
+
+int
+rwlocktest(int nargs, char **args)
+{
+	int i, result, policy;
+
+	(void)args;
+
+	inititems();
+	policy = nargs > 1 ? RWLOCK_WRITER_PREF : RWLOCK_FAIR;
+	testrwlock = rwlock_create("testrwlock", policy);
+	if (testrwlock == NULL) {
+		panic("rwlocktest: rwlock_create failed\n");
+	}
+	testval1 = testval2 = testval3 = 0;
+
+	kprintf("Starting rwlock test (%s)...\n",
+		policy == RWLOCK_FAIR ? "fair" : "writer preference");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwlocktestthread,
+				     NULL, i);
+		if (result) {
+			panic("rwlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+
+	kprintf("RW lock test done.\n");
+
+	return 0;
+}
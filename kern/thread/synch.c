@@ -38,6 +38,8 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
+#include <clock.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -138,6 +140,16 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * How many times to poll a held lock whose holder is running before
+ * giving up and sleeping.
+ */
+#define LOCK_SPIN_MAX 2000
+
+/* All locks, for lockstat. */
+static struct spinlock alllocks_spinlock = SPINLOCK_INITIALIZER;
+static struct lock *alllocks = NULL;
+
 struct lock *
 lock_create(const char *name)
 {
@@ -170,10 +182,26 @@ lock_create(const char *name)
         // initializing lock struct to being unlocked, and having no holder
         lock->is_locked = false;
         lock->lock_holder = NULL;
+        lock->lk_holdercpu = NULL;
 
         // use spinlock initializer to create a spinlock for the lock
         spinlock_init(&(lock->lock_spinlock));
 
+        lock->lk_acquires = 0;
+        lock->lk_contended = 0;
+        lock->lk_spun = 0;
+        lock->lk_waittime.tv_sec = 0;
+        lock->lk_waittime.tv_nsec = 0;
+
+        spinlock_acquire(&alllocks_spinlock);
+        lock->lk_prev = NULL;
+        lock->lk_next = alllocks;
+        if (alllocks != NULL) {
+            alllocks->lk_prev = lock;
+        }
+        alllocks = lock;
+        spinlock_release(&alllocks_spinlock);
+
         return lock;
 }
 
@@ -185,6 +213,17 @@ lock_destroy(struct lock *lock)
 
         // add stuff here as needed
 
+        spinlock_acquire(&alllocks_spinlock);
+        if (lock->lk_prev == NULL) {
+            alllocks = lock->lk_next;
+        } else {
+            lock->lk_prev->lk_next = lock->lk_next;
+        }
+        if (lock->lk_next != NULL) {
+            lock->lk_next->lk_prev = lock->lk_prev;
+        }
+        spinlock_release(&alllocks_spinlock);
+
         //call spinlock's and wait channels destroy functions
         spinlock_cleanup(&(lock->lock_spinlock));
         wchan_destroy(lock->lock_wchan);
@@ -194,29 +233,108 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Check whether a lock's holder is still running on the cpu it took
+ * the lock on. Only the cpu is read, never the holder itself, which
+ * may exit and be freed once we've let go of the lock's spinlock.
+ * A holder that moved to another cpu just counts as not running.
+ */
+static
+bool
+lock_holder_running(struct lock *lock, volatile struct thread *holder)
+{
+        volatile struct cpu *c = lock->lk_holdercpu;
+
+        return c != NULL && c->c_curthread == holder;
+}
+
+/*
+ * Poll a held lock, without its spinlock, for as long as the holder
+ * stays on its cpu. Returns true if the lock was seen free.
+ */
+static
+bool
+lock_spin(struct lock *lock, volatile struct thread *holder)
+{
+        unsigned i;
+
+        for (i = 0; i < LOCK_SPIN_MAX; i++) {
+            if (!lock->is_locked) {
+                return true;
+            }
+            if (lock->lock_holder != holder ||
+                !lock_holder_running(lock, holder)) {
+                return false;
+            }
+        }
+        return false;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
-        // Write this
+        volatile struct thread *holder;
+        struct timespec start, end, diff;
+        bool contended = false;
+        bool slept = false;
+        bool spun = false;
+
         KASSERT(lock != NULL);
 
         //Make sure interrupts are off
         KASSERT(curthread->t_in_interrupt == false);
 
         spinlock_acquire(&(lock->lock_spinlock));
-
-        //While the lock is locked, release this spinlock, and sleep this thread
-        while(lock->is_locked) {
-            wchan_sleep(lock->lock_wchan, &lock->lock_spinlock);
+        lock->lk_acquires++;
+
+        if (lock->is_locked) {
+            lock->lk_contended++;
+            contended = true;
+
+            // read the clock without holding everyone else off the lock
+            spinlock_release(&lock->lock_spinlock);
+            gettime(&start);
+            spinlock_acquire(&lock->lock_spinlock);
+
+            while (lock->is_locked) {
+                holder = lock->lock_holder;
+                KASSERT(holder != curthread);
+
+                // the holder is running elsewhere and will likely release soon;
+                // spin once per wakeup before paying for a sleep
+                if (!spun && holder != NULL &&
+                    lock_holder_running(lock, holder)) {
+                    spun = true;
+                    spinlock_release(&lock->lock_spinlock);
+                    lock_spin(lock, holder);
+                    spinlock_acquire(&lock->lock_spinlock);
+                    continue;
+                }
+
+                //release this spinlock, and sleep this thread
+                wchan_sleep(lock->lock_wchan, &lock->lock_spinlock);
+                slept = true;
+                spun = false;
+            }
         }
 
         lock->is_locked = true;
         lock->lock_holder=curthread;
+        lock->lk_holdercpu = curcpu->c_self;
 
         spinlock_release(&(lock->lock_spinlock));
 
+        if (contended) {
+            gettime(&end);
+            timespec_sub(&end, &start, &diff);
 
-        //(void)lock;  // suppress warning until code gets written
+            spinlock_acquire(&lock->lock_spinlock);
+            timespec_add(&lock->lk_waittime, &diff, &lock->lk_waittime);
+            if (!slept) {
+                lock->lk_spun++;
+            }
+            spinlock_release(&lock->lock_spinlock);
+        }
 }
 
 void
@@ -231,6 +349,7 @@ lock_release(struct lock *lock)
         //release lock
         lock->is_locked = false;
         lock->lock_holder = NULL;
+        lock->lk_holdercpu = NULL;
         //wake the next thread on the wait channel
         wchan_wakeone(lock->lock_wchan, &lock->lock_spinlock);
 
@@ -251,6 +370,99 @@ lock_do_i_hold(struct lock *lock)
         return true; // dummy until code gets written*/
 }
 
+/*
+ * Lock statistics.
+ */
+
+#define LOCKSTAT_TOP 16
+
+struct lockstat {
+        char ls_name[32];
+        unsigned ls_acquires;
+        unsigned ls_contended;
+        unsigned ls_spun;
+        struct timespec ls_waittime;
+};
+
+/* Orders locks by time spent waiting for them. */
+static
+bool
+lockstat_before(const struct timespec *a, const struct timespec *b)
+{
+        return a->tv_sec > b->tv_sec ||
+               (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+void
+lockstat_print(void)
+{
+        static struct lockstat top[LOCKSTAT_TOP];
+        struct lock *lock;
+        unsigned ntop = 0, nlocks = 0, i, j;
+        unsigned long long acquires = 0, contended = 0;
+
+        // snapshot the worst offenders, since we can't print with the spinlock held
+        spinlock_acquire(&alllocks_spinlock);
+        for (lock = alllocks; lock != NULL; lock = lock->lk_next) {
+            nlocks++;
+            acquires += lock->lk_acquires;
+            contended += lock->lk_contended;
+            if (lock->lk_contended == 0) {
+                continue;
+            }
+
+            // insertion into the sorted table, dropping the least contended
+            for (i = 0; i < ntop; i++) {
+                if (lockstat_before(&lock->lk_waittime, &top[i].ls_waittime)) {
+                    break;
+                }
+            }
+            if (i == LOCKSTAT_TOP) {
+                continue;
+            }
+            if (ntop < LOCKSTAT_TOP) {
+                ntop++;
+            }
+            for (j = ntop - 1; j > i; j--) {
+                top[j] = top[j - 1];
+            }
+            snprintf(top[i].ls_name, sizeof(top[i].ls_name), "%s", lock->lk_name);
+            top[i].ls_acquires = lock->lk_acquires;
+            top[i].ls_contended = lock->lk_contended;
+            top[i].ls_spun = lock->lk_spun;
+            top[i].ls_waittime = lock->lk_waittime;
+        }
+        spinlock_release(&alllocks_spinlock);
+
+        kprintf("%u locks, %llu acquisitions, %llu contended\n",
+                nlocks, acquires, contended);
+        kprintf("%-24s %10s %10s %10s %14s\n",
+                "lock", "acquires", "contended", "spun", "wait (s)");
+        for (i = 0; i < ntop; i++) {
+            kprintf("%-24s %10u %10u %10u %4llu.%09lu\n",
+                    top[i].ls_name, top[i].ls_acquires, top[i].ls_contended,
+                    top[i].ls_spun,
+                    (unsigned long long) top[i].ls_waittime.tv_sec,
+                    (unsigned long) top[i].ls_waittime.tv_nsec);
+        }
+}
+
+void
+lockstat_reset(void)
+{
+        struct lock *lock;
+
+        spinlock_acquire(&alllocks_spinlock);
+        for (lock = alllocks; lock != NULL; lock = lock->lk_next) {
+            lock->lk_acquires = 0;
+            lock->lk_contended = 0;
+            lock->lk_spun = 0;
+            lock->lk_waittime.tv_sec = 0;
+            lock->lk_waittime.tv_nsec = 0;
+        }
+        spinlock_release(&alllocks_spinlock);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -350,3 +562,161 @@ cv_broadcast(struct cv *cv, struct lock *lock)
         spinlock_release(&cv->cv_spinlock);
 
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock
+
+struct rwlock *
+rwlock_create(const char *name, int policy)
+{
+        struct rwlock *rw;
+
+        KASSERT(policy == RWLOCK_FAIR || policy == RWLOCK_WRITER_PREF);
+
+        rw = kmalloc(sizeof(*rw));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rwlock_name = kstrdup(name);
+        if (rw->rwlock_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_lock = lock_create(name);
+        if (rw->rw_lock == NULL) {
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_readcv = cv_create(name);
+        if (rw->rw_readcv == NULL) {
+                lock_destroy(rw->rw_lock);
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_writecv = cv_create(name);
+        if (rw->rw_writecv == NULL) {
+                cv_destroy(rw->rw_readcv);
+                lock_destroy(rw->rw_lock);
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_policy = policy;
+        rw->rw_readers = 0;
+        rw->rw_readers_waiting = 0;
+        rw->rw_writers_waiting = 0;
+        rw->rw_readturn = 0;
+        rw->rw_writer = NULL;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+
+        cv_destroy(rw->rw_writecv);
+        cv_destroy(rw->rw_readcv);
+        lock_destroy(rw->rw_lock);
+        kfree(rw->rwlock_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_writer != curthread);
+
+        lock_acquire(rw->rw_lock);
+
+        // stand aside for waiting writers, unless a writer just let us in
+        while (rw->rw_writer != NULL ||
+               (rw->rw_writers_waiting > 0 && rw->rw_readturn == 0)) {
+                rw->rw_readers_waiting++;
+                cv_wait(rw->rw_readcv, rw->rw_lock);
+                rw->rw_readers_waiting--;
+        }
+        if (rw->rw_readturn > 0) {
+                rw->rw_readturn--;
+        }
+        rw->rw_readers++;
+
+        lock_release(rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        lock_acquire(rw->rw_lock);
+
+        KASSERT(rw->rw_readers > 0);
+        rw->rw_readers--;
+        if (rw->rw_readers == 0 && rw->rw_writers_waiting > 0) {
+                cv_signal(rw->rw_writecv, rw->rw_lock);
+        }
+
+        lock_release(rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_writer != curthread);
+
+        lock_acquire(rw->rw_lock);
+
+        rw->rw_writers_waiting++;
+        while (rw->rw_writer != NULL || rw->rw_readers > 0 || rw->rw_readturn > 0) {
+                cv_wait(rw->rw_writecv, rw->rw_lock);
+        }
+        rw->rw_writers_waiting--;
+        rw->rw_writer = curthread;
+
+        lock_release(rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        lock_acquire(rw->rw_lock);
+
+        KASSERT(rw->rw_writer == curthread);
+        rw->rw_writer = NULL;
+
+        if (rw->rw_readers_waiting > 0 &&
+            (rw->rw_policy == RWLOCK_FAIR || rw->rw_writers_waiting == 0)) {
+                // admit everyone who queued up behind us before the next writer
+                if (rw->rw_writers_waiting > 0) {
+                        rw->rw_readturn = rw->rw_readers_waiting;
+                }
+                cv_broadcast(rw->rw_readcv, rw->rw_lock);
+        }
+        else if (rw->rw_writers_waiting > 0) {
+                cv_signal(rw->rw_writecv, rw->rw_lock);
+        }
+
+        lock_release(rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        return rw->rw_writer == curthread;
+}
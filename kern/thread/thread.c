@@ -70,7 +70,6 @@ static struct cpuarray allcpus;
 
 struct semaphore *tlb_shootdown_count;
 struct semaphore *tlb_shootdown_free;
-struct tlbshootdown tlb_shootdown;
 
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
@@ -146,6 +145,9 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_queuedat = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -179,6 +181,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -192,10 +195,14 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
-	c->c_tlb_pid = 0;
+	c->c_asid = 0;
+	c->c_asid_generation = 0;
+	c->c_numframes = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NQUEUES; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -326,6 +333,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -340,9 +349,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NQUEUES; i++) {
+		struct threadlist *q = &curcpu->c_runqueue[i];
+		q->tl_count = 0;
+		q->tl_head.tln_next = &q->tl_tail;
+		q->tl_tail.tln_prev = &q->tl_head;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -413,7 +425,6 @@ thread_bootstrap(void)
 	/* Initialize the necessary TLB shootdown fields */
 	tlb_shootdown_count = sem_create("TLBSHOOTDOWN INTERRUPT COUNTER", 0);
 	tlb_shootdown_free = sem_create("TLBSHOOTDOWN LOCK", 1);
-	tlb_shootdown.badaddr = 0;
 	/* Done */
 }
 
@@ -443,6 +454,22 @@ cpu_hatch(unsigned software_number)
 	thread_exit();
 }
 
+/*
+ * Count the frames in every cpu's free-frame cache. The counts are
+ * read without any locks, as a hint for the pageout watermarks.
+ */
+unsigned
+cpu_cachedframes(void)
+{
+	unsigned i, numcpus, total = 0;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		total += cpuarray_get(&allcpus, i)->c_numframes;
+	}
+	return total;
+}
+
 /*
  * Start up secondary cpus. Called from boot().
  */
@@ -465,6 +492,150 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue helpers. Each cpu has SCHED_NQUEUES run queues, one per
+ * priority level, with level 0 the highest. All of these are called
+ * with the cpu's run queue lock held.
+ */
+
+/* Total number of threads waiting on a cpu's run queues. */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned i, count = 0;
+
+	for (i=0; i<SCHED_NQUEUES; i++) {
+		count += c->c_runqueue[i].tl_count;
+	}
+	return count;
+}
+
+/* Take the first thread off the highest priority non-empty queue. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	unsigned i;
+
+	for (i=0; i<SCHED_NQUEUES; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return threadlist_remhead(&c->c_runqueue[i]);
+		}
+	}
+	return NULL;
+}
+
+/* Take the last thread off the lowest priority non-empty queue. */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	unsigned i;
+
+	for (i=SCHED_NQUEUES; i-- > 0; ) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return threadlist_remtail(&c->c_runqueue[i]);
+		}
+	}
+	return NULL;
+}
+
+/* Is anything queued at a higher priority than the given level? */
+static
+bool
+runqueue_has_higher(struct cpu *c, unsigned priority)
+{
+	unsigned i;
+
+	for (i=0; i<priority; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Work stealing.
+ *
+ * When a cpu runs out of threads, rather than idling until someone
+ * hands it work it takes a thread from the tail of the busiest other
+ * cpu's run queues. A thread that was queued within the last
+ * STEAL_AFFINITY_HARDCLOCKS ticks probably still has its working set
+ * in the other cpu's cache and will get to run there soon, so leave
+ * it be.
+ *
+ * Called from thread_switch with no run queue lock held. Returns true
+ * if a thread was moved onto the current cpu's run queue.
+ */
+#define STEAL_AFFINITY_HARDCLOCKS	2
+
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t, *cand;
+	unsigned i, numcpus, count, best;
+
+	/*
+	 * Pick the busiest cpu. The counts are read without the locks,
+	 * as a hint only; we check again once the victim is locked.
+	 */
+	victim = NULL;
+	best = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		count = runqueue_count(c);
+		if (count > best) {
+			best = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	/* Look for a cold thread, starting from the lowest priority tail. */
+	t = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (i=SCHED_NQUEUES; i-- > 0 && t == NULL; ) {
+		THREADLIST_FORALL_REV(cand, victim->c_runqueue[i]) {
+			/* See thread_consider_migration about curthread. */
+			if (cand != victim->c_curthread &&
+			    victim->c_hardclocks - cand->t_queuedat >=
+			    STEAL_AFFINITY_HARDCLOCKS) {
+				t = cand;
+				break;
+			}
+		}
+	}
+	if (t != NULL) {
+		threadlist_remove(&victim->c_runqueue[t->t_priority], t);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t == NULL) {
+		return false;
+	}
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	t->t_cpu = curcpu->c_self;
+	t->t_queuedat = curcpu->c_hardclocks;
+	threadlist_addtail(&curcpu->c_runqueue[t->t_priority], t);
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return true;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -487,9 +658,20 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
+	/*
+	 * A thread waking up from wchan_sleep has been waiting rather
+	 * than computing; boost it to the top level so it gets the cpu
+	 * back quickly.
+	 */
+	if (target->t_state == S_SLEEP) {
+		target->t_priority = 0;
+		target->t_ticks = 0;
+	}
+
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	target->t_queuedat = targetcpu->c_hardclocks;
+	threadlist_addtail(&targetcpu->c_runqueue[target->t_priority], target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -635,7 +817,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && runqueue_count(curcpu) == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -698,10 +880,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -920,17 +1104,79 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Threads start at level 0 and
+ * drop a level each time they use up a whole quantum, which doubles
+ * at each level; threads that sleep are boosted back to level 0 when
+ * they wake up, so interactive threads stay ahead of cpu-bound ones.
+ * Within a level threads run round-robin.
+ */
+
+/* Quantum, in hardclocks, of a thread at the given level. */
+#define SCHED_QUANTUM(level)	(1U << (level))
+
+/* Boost everything back to level 0 this often, to prevent starvation. */
+#define SCHED_BOOST_HARDCLOCKS	128
+
+/*
+ * Charge the current thread for a hardclock; returns true if it
+ * should yield.
  */
+bool
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	bool yield = false;
+
+	if (curcpu->c_isidle) {
+		return false;
+	}
 
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+		if (cur->t_priority < SCHED_NQUEUES - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+		yield = true;
+	}
+	else if (runqueue_has_higher(curcpu, cur->t_priority)) {
+		yield = true;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return yield;
+}
+
+/*
+ * This is called periodically from hardclock(). Every so often it
+ * ages the current CPU's run queues by moving every thread back up to
+ * level 0, so long-running threads can't be starved by a steady
+ * stream of short ones.
+ */
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+	unsigned i;
+
+	if ((curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS) != 0) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NQUEUES; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			t->t_priority = 0;
+			t->t_ticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
 
 /*
@@ -964,9 +1210,9 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += runqueue_count(c);
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = runqueue_count(c);
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -980,7 +1226,8 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		/* Send the lowest priority threads. */
+		t = runqueue_remtail(curcpu);
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -991,7 +1238,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (runqueue_count(c) < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -1022,7 +1269,8 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			t->t_queuedat = c->c_hardclocks;
+			threadlist_addtail(&c->c_runqueue[t->t_priority], t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -1046,7 +1294,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			threadlist_addtail(&curcpu->c_runqueue[t->t_priority], t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1238,12 +1486,23 @@ ipi_broadcast(int code)
 void
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	unsigned n;
+	ipi_tlbshootdown_batch(target, mapping, 1);
+}
+
+/*
+ * Send one TLB shootdown IPI to the specified CPU, carrying several
+ * mappings.
+ */
+void
+ipi_tlbshootdown_batch(struct cpu *target,
+		       const struct tlbshootdown *mappings, unsigned num)
+{
+	unsigned n, i;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
+	if (n + num > TLBSHOOTDOWN_MAX) {
 		/*
 		 * If you have problems with this panic going off,
 		 * consider: (1) increasing the maximum, (2) putting
@@ -1256,8 +1515,10 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
 	}
 	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+		for (i=0; i<num; i++) {
+			target->c_shootdown[n+i] = mappings[i];
+		}
+		target->c_numshootdown = n+num;
 	}
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
@@ -1361,22 +1622,55 @@ thread_join(struct thread * child)
 }
 
 /* include in vm.h; move code to thread.c to be able to use cpu array */
-void vm_tlbshootdown_all(vaddr_t badaddr){
+void vm_tlbshootdown_pages(struct addrspace *as, const vaddr_t *addrs, unsigned num){
+	struct tlbshootdown mappings[TLBSHOOTDOWN_MAX];
 	unsigned numcpus = cpuarray_num(&allcpus);
 
 	P(tlb_shootdown_free);
 
-	tlb_shootdown.badaddr = badaddr;
+	// only cpus that have run the address space since it got its ID can hold its entries
+	uint32_t cpus = vm_tlb_cpus(as);
 
-	for(unsigned i = 0; i < numcpus; i++){
-		struct cpu *target = cpuarray_get(&allcpus, i);
-		
-		ipi_tlbshootdown(target, &tlb_shootdown);
-	}
+	while(num > 0){
+		unsigned n = num < TLBSHOOTDOWN_MAX ? num : TLBSHOOTDOWN_MAX;
+		for(unsigned i = 0; i < n; i++){
+			mappings[i].badaddr = addrs[i];
+			mappings[i].asid = as->asid;
+		}
+
+		// our own TLB we can fix up directly
+		int spl = splhigh();
+		struct cpu *self = curcpu->c_self;
+		if(cpus & ((uint32_t)1 << self->c_number)){
+			for(unsigned i = 0; i < n; i++){
+				vm_tlbshootdown(&mappings[i]);
+			}
+		}
+		splx(spl);
+
+		unsigned sent = 0;
+		for(unsigned i = 0; i < numcpus; i++){
+			struct cpu *target = cpuarray_get(&allcpus, i);
+			if(target == self || !(cpus & ((uint32_t)1 << i))){
+				continue;
+			}
+			ipi_tlbshootdown_batch(target, mappings, n);
+			sent++;
+		}
+		vmstat_add(VMSTAT_SHOOTDOWN_IPIS, sent);
+		vmstat_add(VMSTAT_SHOOTDOWN_PAGES, n);
 
-	for(unsigned i = 0; i <  numcpus; i++){
-		P(tlb_shootdown_count);
+		for(unsigned i = 0; i < sent; i++){
+			P(tlb_shootdown_count);
+		}
+
+		addrs += n;
+		num -= n;
 	}
 
 	V(tlb_shootdown_free);
 }
+
+void vm_tlbshootdown_page(struct addrspace *as, vaddr_t badaddr){
+	vm_tlbshootdown_pages(as, &badaddr, 1);
+}
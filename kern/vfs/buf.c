@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Disk buffer cache.
+ *
+ * buffer_lock protects the hash chains, the LRU list, the counters,
+ * and every buffer's b_busy flag. The rest of a buffer belongs to
+ * whoever has it busy, so disk I/O is done without holding the lock.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <fs.h>
+#include <buf.h>
+
+#define BUFFER_HASH_SIZE 256
+
+struct buf {
+	struct fs *b_fs;		/* filesystem the block belongs to */
+	daddr_t b_block;		/* block number on that filesystem */
+	void *b_data;			/* BUFFER_SIZE bytes */
+	bool b_valid;			/* b_data holds the block's contents */
+	bool b_dirty;			/* b_data is newer than the disk */
+	bool b_busy;			/* handed out, or being written back */
+	bool b_werror;			/* the last write-back of b_data failed */
+
+	struct buf *b_hashnext;		/* next in the hash chain */
+	struct buf *b_lrunext;		/* toward the least recently used */
+	struct buf *b_lruprev;		/* toward the most recently used */
+};
+
+static struct lock *buffer_lock;
+static struct cv *buffer_cv;		/* signalled when a buffer stops being busy */
+
+static struct buf *buffer_hash[BUFFER_HASH_SIZE];
+static struct buf *buffer_lruhead;	/* most recently used */
+static struct buf *buffer_lrutail;	/* least recently used */
+static unsigned buffer_count;
+static unsigned buffer_max = BUFFER_DEFAULT_MAX;
+
+static unsigned buffer_lookups;
+static unsigned buffer_hits;
+static unsigned buffer_reads;
+static unsigned buffer_writes;
+static unsigned buffer_evictions;
+
+void
+buffer_bootstrap(void)
+{
+	buffer_lock = lock_create("buffer cache");
+	buffer_cv = cv_create("buffer cache");
+	if (buffer_lock == NULL || buffer_cv == NULL) {
+		panic("buffer_bootstrap: out of memory\n");
+	}
+}
+
+static
+unsigned
+buffer_hashfunc(struct fs *fs, daddr_t block)
+{
+	return (((uintptr_t)fs >> 4) + block * 31) % BUFFER_HASH_SIZE;
+}
+
+static
+struct buf *
+buffer_lookup(struct fs *fs, daddr_t block)
+{
+	struct buf *b;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	for (b = buffer_hash[buffer_hashfunc(fs, block)];
+	     b != NULL; b = b->b_hashnext) {
+		if (b->b_fs == fs && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buffer_lru_remove(struct buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		buffer_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		buffer_lrutail = b->b_lruprev;
+	}
+	b->b_lrunext = b->b_lruprev = NULL;
+}
+
+static
+void
+buffer_lru_push(struct buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = buffer_lruhead;
+	if (buffer_lruhead != NULL) {
+		buffer_lruhead->b_lruprev = b;
+	}
+	else {
+		buffer_lrutail = b;
+	}
+	buffer_lruhead = b;
+}
+
+static
+void
+buffer_hash_insert(struct buf *b)
+{
+	unsigned h = buffer_hashfunc(b->b_fs, b->b_block);
+
+	b->b_hashnext = buffer_hash[h];
+	buffer_hash[h] = b;
+}
+
+static
+void
+buffer_hash_remove(struct buf *b)
+{
+	struct buf **p;
+
+	for (p = &buffer_hash[buffer_hashfunc(b->b_fs, b->b_block)];
+	     *p != NULL; p = &(*p)->b_hashnext) {
+		if (*p == b) {
+			*p = b->b_hashnext;
+			b->b_hashnext = NULL;
+			return;
+		}
+	}
+	panic("buffer_hash_remove: buffer not in the cache\n");
+}
+
+/*
+ * Take a buffer out of the cache entirely. It must not be busy.
+ */
+static
+void
+buffer_destroy(struct buf *b)
+{
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(!b->b_busy);
+
+	buffer_hash_remove(b);
+	buffer_lru_remove(b);
+	buffer_count--;
+	kfree(b->b_data);
+	kfree(b);
+}
+
+/*
+ * Write a busy, dirty buffer back. Called with buffer_lock held; it
+ * is dropped across the I/O.
+ */
+static
+int
+buffer_writeback(struct buf *b)
+{
+	int result;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_dirty);
+
+	lock_release(buffer_lock);
+	result = b->b_fs->fs_ops->fsop_writeblock(b->b_fs, b->b_block,
+						  b->b_data, BUFFER_SIZE);
+	lock_acquire(buffer_lock);
+
+	buffer_writes++;
+	if (result == 0) {
+		b->b_dirty = false;
+		b->b_werror = false;
+	}
+	else {
+		b->b_werror = true;
+	}
+	return result;
+}
+
+/*
+ * Evict the least recently used buffer that isn't busy, to make room
+ * for another. Buffers whose write-back has failed are passed over,
+ * so one bad block can't be picked again and again; buffer_sync
+ * still retries them.
+ *
+ * Returns 0 if a buffer was evicted. Returns EAGAIN if the lock was
+ * dropped, to write a dirty victim back or to wait for a busy buffer,
+ * so the caller must look again. Returns EIO if every buffer that
+ * isn't busy has failed to write back, so there is nothing to evict.
+ */
+static
+int
+buffer_evict(void)
+{
+	struct buf *b;
+	bool anyidle = false;
+	int result;
+
+	for (b = buffer_lrutail; b != NULL; b = b->b_lruprev) {
+		if (b->b_busy) {
+			continue;
+		}
+		anyidle = true;
+		if (!b->b_werror) {
+			break;
+		}
+	}
+	if (b == NULL && anyidle) {
+		return EIO;
+	}
+	if (b == NULL) {
+		cv_wait(buffer_cv, buffer_lock);
+		return EAGAIN;
+	}
+
+	if (b->b_dirty) {
+		b->b_busy = true;
+		result = buffer_writeback(b);
+		b->b_busy = false;
+		cv_broadcast(buffer_cv, buffer_lock);
+		if (result) {
+			kprintf("buffer cache: block %u: write error %d\n",
+				b->b_block, result);
+		}
+		return EAGAIN;
+	}
+
+	buffer_destroy(b);
+	buffer_evictions++;
+	return 0;
+}
+
+/*
+ * Common code for buffer_read and buffer_get.
+ */
+static
+int
+buffer_acquire(struct fs *fs, daddr_t block, bool doread, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	lock_acquire(buffer_lock);
+	buffer_lookups++;
+
+	while (1) {
+		b = buffer_lookup(fs, block);
+		if (b != NULL) {
+			if (b->b_busy) {
+				cv_wait(buffer_cv, buffer_lock);
+				continue;
+			}
+			if (b->b_valid) {
+				buffer_hits++;
+			}
+			break;
+		}
+
+		/* after the budget shrinks, this may take several */
+		if (buffer_count >= buffer_max) {
+			result = buffer_evict();
+			if (result && result != EAGAIN) {
+				lock_release(buffer_lock);
+				return result;
+			}
+			continue;
+		}
+
+		b = kmalloc(sizeof(*b));
+		if (b == NULL) {
+			lock_release(buffer_lock);
+			return ENOMEM;
+		}
+		b->b_data = kmalloc(BUFFER_SIZE);
+		if (b->b_data == NULL) {
+			kfree(b);
+			lock_release(buffer_lock);
+			return ENOMEM;
+		}
+		b->b_fs = fs;
+		b->b_block = block;
+		b->b_valid = false;
+		b->b_dirty = false;
+		b->b_busy = false;
+		b->b_werror = false;
+		b->b_lrunext = b->b_lruprev = NULL;
+		buffer_hash_insert(b);
+		buffer_lru_push(b);
+		buffer_count++;
+		break;
+	}
+
+	b->b_busy = true;
+	buffer_lru_remove(b);
+	buffer_lru_push(b);
+
+	if (doread && !b->b_valid) {
+		lock_release(buffer_lock);
+		result = fs->fs_ops->fsop_readblock(fs, block, b->b_data,
+						    BUFFER_SIZE);
+		lock_acquire(buffer_lock);
+		buffer_reads++;
+		if (result) {
+			b->b_busy = false;
+			buffer_destroy(b);
+			cv_broadcast(buffer_cv, buffer_lock);
+			lock_release(buffer_lock);
+			return result;
+		}
+	}
+	/* buffer_get callers fill in the whole block */
+	b->b_valid = true;
+
+	lock_release(buffer_lock);
+
+	*ret = b;
+	return 0;
+}
+
+int
+buffer_read(struct fs *fs, daddr_t block, struct buf **ret)
+{
+	return buffer_acquire(fs, block, true, ret);
+}
+
+int
+buffer_get(struct fs *fs, daddr_t block, struct buf **ret)
+{
+	return buffer_acquire(fs, block, false, ret);
+}
+
+struct buf *
+buffer_peek(struct fs *fs, daddr_t block)
+{
+	struct buf *b;
+
+	lock_acquire(buffer_lock);
+	while (1) {
+		b = buffer_lookup(fs, block);
+		if (b == NULL || !b->b_busy) {
+			break;
+		}
+		cv_wait(buffer_cv, buffer_lock);
+	}
+	if (b != NULL) {
+		buffer_lookups++;
+		buffer_hits++;
+		b->b_busy = true;
+		buffer_lru_remove(b);
+		buffer_lru_push(b);
+	}
+	lock_release(buffer_lock);
+
+	return b;
+}
+
+void *
+buffer_map(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+void
+buffer_mark_dirty(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	b->b_dirty = true;
+}
+
+void
+buffer_release(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+	KASSERT(b->b_busy);
+	b->b_busy = false;
+	cv_broadcast(buffer_cv, buffer_lock);
+	lock_release(buffer_lock);
+}
+
+int
+buffer_sync(struct fs *fs)
+{
+	struct buf *b;
+	int result, ret = 0;
+
+	lock_acquire(buffer_lock);
+ again:
+	for (b = buffer_lruhead; b != NULL; b = b->b_lrunext) {
+		if (b->b_fs != fs || !b->b_dirty) {
+			continue;
+		}
+		if (b->b_busy) {
+			/* somebody is still using it; they may dirty it more */
+			cv_wait(buffer_cv, buffer_lock);
+			goto again;
+		}
+		b->b_busy = true;
+		result = buffer_writeback(b);
+		b->b_busy = false;
+		cv_broadcast(buffer_cv, buffer_lock);
+		if (result) {
+			/* leave it dirty, and carry on with the rest */
+			kprintf("buffer cache: block %u: write error %d\n",
+				b->b_block, result);
+			ret = result;
+			continue;
+		}
+		/* the list may have changed while the lock was dropped */
+		goto again;
+	}
+	lock_release(buffer_lock);
+
+	return ret;
+}
+
+void
+buffer_drop(struct fs *fs, daddr_t block)
+{
+	struct buf *b;
+
+	lock_acquire(buffer_lock);
+	while (1) {
+		b = buffer_lookup(fs, block);
+		if (b == NULL || !b->b_busy) {
+			break;
+		}
+		cv_wait(buffer_cv, buffer_lock);
+	}
+	if (b != NULL) {
+		buffer_destroy(b);
+	}
+	lock_release(buffer_lock);
+}
+
+void
+buffer_drop_fs(struct fs *fs)
+{
+	struct buf *b, *next;
+
+	lock_acquire(buffer_lock);
+	for (b = buffer_lruhead; b != NULL; b = next) {
+		next = b->b_lrunext;
+		if (b->b_fs == fs) {
+			/* the unmount must have synced */
+			KASSERT(!b->b_busy);
+			KASSERT(!b->b_dirty);
+			buffer_destroy(b);
+		}
+	}
+	lock_release(buffer_lock);
+}
+
+int
+buffer_set_budget(unsigned kbytes)
+{
+	unsigned max = kbytes * 1024 / BUFFER_SIZE;
+	int result;
+
+	if (max < BUFFER_MIN) {
+		return EINVAL;
+	}
+
+	/*
+	 * Evict down to the new budget now. Busy buffers are waited
+	 * for; if what's left can't be written back, buffer_acquire
+	 * keeps trying as buffers are next needed.
+	 */
+	lock_acquire(buffer_lock);
+	buffer_max = max;
+	while (buffer_count > buffer_max) {
+		result = buffer_evict();
+		if (result && result != EAGAIN) {
+			break;
+		}
+	}
+	lock_release(buffer_lock);
+	return 0;
+}
+
+void
+buffer_printstats(void)
+{
+	unsigned count, max, lookups, hits, reads, writes, evictions;
+
+	/* copy out first; kprintf can sleep */
+	lock_acquire(buffer_lock);
+	count = buffer_count;
+	max = buffer_max;
+	lookups = buffer_lookups;
+	hits = buffer_hits;
+	reads = buffer_reads;
+	writes = buffer_writes;
+	evictions = buffer_evictions;
+	lock_release(buffer_lock);
+
+	kprintf("%20s: %u of %u (%uK)\n", "buffers", count, max,
+		max * BUFFER_SIZE / 1024);
+	kprintf("%20s: %u\n", "lookups", lookups);
+	kprintf("%20s: %u\n", "hits", hits);
+	if (lookups > 0) {
+		kprintf("%20s: %u%%\n", "hit rate", hits * 100 / lookups);
+	}
+	kprintf("%20s: %u\n", "disk reads", reads);
+	kprintf("%20s: %u\n", "disk writes", writes);
+	kprintf("%20s: %u\n", "evictions", evictions);
+}
+
+void
+buffer_resetstats(void)
+{
+	lock_acquire(buffer_lock);
+	buffer_lookups = 0;
+	buffer_hits = 0;
+	buffer_reads = 0;
+	buffer_writes = 0;
+	buffer_evictions = 0;
+	lock_release(buffer_lock);
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Directory name lookup cache.
+ *
+ * dcache_lock protects the hash chains, the LRU list, and the
+ * counters. Entries are never changed in place except for de_vn;
+ * references held by entries that go away are dropped only after
+ * the lock is released, since dropping one can reclaim a vnode.
+ */
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <dcache.h>
+
+#define DCACHE_HASH_SIZE 128
+
+struct dcache_entry {
+	struct vnode *de_dir;		/* directory the name is in */
+	char *de_name;			/* the name */
+	struct vnode *de_vn;		/* what it names; NULL if nothing */
+
+	struct dcache_entry *de_hashnext; /* next in the hash chain */
+	struct dcache_entry *de_lrunext;  /* toward the least recently used */
+	struct dcache_entry *de_lruprev;  /* toward the most recently used */
+};
+
+static struct lock *dcache_lock;
+
+static struct dcache_entry *dcache_hash[DCACHE_HASH_SIZE];
+static struct dcache_entry *dcache_lruhead;	/* most recently used */
+static struct dcache_entry *dcache_lrutail;	/* least recently used */
+static unsigned dcache_count;
+
+static unsigned dcache_lookups;
+static unsigned dcache_hits;
+static unsigned dcache_neghits;
+static unsigned dcache_enters;
+static unsigned dcache_invalidations;
+static unsigned dcache_evictions;
+
+void
+dcache_bootstrap(void)
+{
+	dcache_lock = lock_create("dcache");
+	if (dcache_lock == NULL) {
+		panic("dcache_bootstrap: out of memory\n");
+	}
+}
+
+static
+unsigned
+dcache_hashfunc(struct vnode *dir, const char *name)
+{
+	unsigned h = (uintptr_t)dir >> 4;
+
+	while (*name) {
+		h = h * 31 + (unsigned char)*name++;
+	}
+	return h % DCACHE_HASH_SIZE;
+}
+
+/*
+ * Find an entry and the hash chain link that points to it.
+ */
+static
+struct dcache_entry **
+dcache_find(struct vnode *dir, const char *name)
+{
+	struct dcache_entry **pp;
+
+	KASSERT(lock_do_i_hold(dcache_lock));
+	for (pp = &dcache_hash[dcache_hashfunc(dir, name)];
+	     *pp != NULL; pp = &(*pp)->de_hashnext) {
+		if ((*pp)->de_dir == dir && !strcmp((*pp)->de_name, name)) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+dcache_lru_remove(struct dcache_entry *de)
+{
+	if (de->de_lruprev != NULL) {
+		de->de_lruprev->de_lrunext = de->de_lrunext;
+	}
+	else {
+		dcache_lruhead = de->de_lrunext;
+	}
+	if (de->de_lrunext != NULL) {
+		de->de_lrunext->de_lruprev = de->de_lruprev;
+	}
+	else {
+		dcache_lrutail = de->de_lruprev;
+	}
+	de->de_lrunext = de->de_lruprev = NULL;
+}
+
+static
+void
+dcache_lru_push(struct dcache_entry *de)
+{
+	de->de_lruprev = NULL;
+	de->de_lrunext = dcache_lruhead;
+	if (dcache_lruhead != NULL) {
+		dcache_lruhead->de_lruprev = de;
+	}
+	else {
+		dcache_lrutail = de;
+	}
+	dcache_lruhead = de;
+}
+
+/*
+ * Take an entry out of the cache. PP is its hash chain link.
+ */
+static
+void
+dcache_unlink(struct dcache_entry **pp)
+{
+	struct dcache_entry *de = *pp;
+
+	*pp = de->de_hashnext;
+	de->de_hashnext = NULL;
+	dcache_lru_remove(de);
+	KASSERT(dcache_count > 0);
+	dcache_count--;
+}
+
+/*
+ * Free an entry that is no longer in the cache. Called without
+ * dcache_lock.
+ */
+static
+void
+dcache_destroy(struct dcache_entry *de)
+{
+	if (de->de_vn != NULL) {
+		VOP_DECREF(de->de_vn);
+	}
+	VOP_DECREF(de->de_dir);
+	kfree(de->de_name);
+	kfree(de);
+}
+
+bool
+dcache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct dcache_entry **pp, *de;
+
+	lock_acquire(dcache_lock);
+	dcache_lookups++;
+	pp = dcache_find(dir, name);
+	if (pp == NULL) {
+		lock_release(dcache_lock);
+		return false;
+	}
+	de = *pp;
+
+	dcache_lru_remove(de);
+	dcache_lru_push(de);
+
+	if (de->de_vn != NULL) {
+		VOP_INCREF(de->de_vn);
+		dcache_hits++;
+	}
+	else {
+		dcache_neghits++;
+	}
+	*ret = de->de_vn;
+	lock_release(dcache_lock);
+	return true;
+}
+
+void
+dcache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct dcache_entry **pp, *de, *victim = NULL;
+	struct vnode *oldvn = NULL;
+
+	/*
+	 * Only single names are cached, and not . and .., which are
+	 * cheap to look up and would have directories pin themselves.
+	 */
+	if (strchr(name, '/') != NULL || !strcmp(name, ".") ||
+	    !strcmp(name, "..")) {
+		return;
+	}
+
+	/* The cache is only a hint, so give up quietly on ENOMEM */
+	de = kmalloc(sizeof(*de));
+	if (de == NULL) {
+		return;
+	}
+	de->de_name = kstrdup(name);
+	if (de->de_name == NULL) {
+		kfree(de);
+		return;
+	}
+	de->de_dir = dir;
+	de->de_vn = vn;
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+
+	lock_acquire(dcache_lock);
+	dcache_enters++;
+
+	pp = dcache_find(dir, name);
+	if (pp != NULL) {
+		/* Already there; just update what it points to */
+		oldvn = (*pp)->de_vn;
+		(*pp)->de_vn = vn;
+		dcache_lru_remove(*pp);
+		dcache_lru_push(*pp);
+	}
+	else {
+		de->de_hashnext = dcache_hash[dcache_hashfunc(dir, name)];
+		dcache_hash[dcache_hashfunc(dir, name)] = de;
+		dcache_lru_push(de);
+		dcache_count++;
+		de = NULL;
+
+		if (dcache_count > DCACHE_MAX) {
+			victim = dcache_lrutail;
+			pp = dcache_find(victim->de_dir, victim->de_name);
+			KASSERT(pp != NULL && *pp == victim);
+			dcache_unlink(pp);
+			dcache_evictions++;
+		}
+	}
+	lock_release(dcache_lock);
+
+	if (de != NULL) {
+		/* Not needed after all; the entry's new reference is in use */
+		de->de_vn = NULL;
+		dcache_destroy(de);
+	}
+	if (oldvn != NULL) {
+		VOP_DECREF(oldvn);
+	}
+	if (victim != NULL) {
+		dcache_destroy(victim);
+	}
+}
+
+void
+dcache_invalidate(struct vnode *dir, const char *name)
+{
+	struct dcache_entry **pp, *de = NULL;
+
+	lock_acquire(dcache_lock);
+	pp = dcache_find(dir, name);
+	if (pp != NULL) {
+		de = *pp;
+		dcache_unlink(pp);
+		dcache_invalidations++;
+	}
+	lock_release(dcache_lock);
+
+	if (de != NULL) {
+		dcache_destroy(de);
+	}
+}
+
+void
+dcache_purge_fs(struct fs *fs)
+{
+	struct dcache_entry **pp, *de, *dead = NULL;
+	unsigned i;
+
+	lock_acquire(dcache_lock);
+	for (i = 0; i < DCACHE_HASH_SIZE; i++) {
+		pp = &dcache_hash[i];
+		while (*pp != NULL) {
+			de = *pp;
+			if (de->de_dir->vn_fs != fs) {
+				pp = &de->de_hashnext;
+				continue;
+			}
+			dcache_unlink(pp);
+			/* reuse the hash link to collect the dead ones */
+			de->de_hashnext = dead;
+			dead = de;
+		}
+	}
+	lock_release(dcache_lock);
+
+	while (dead != NULL) {
+		de = dead;
+		dead = de->de_hashnext;
+		dcache_destroy(de);
+	}
+}
+
+void
+dcache_printstats(void)
+{
+	unsigned count, lookups, hits, neghits, enters, invalidations;
+	unsigned evictions;
+
+	/* copy out first; kprintf can sleep */
+	lock_acquire(dcache_lock);
+	count = dcache_count;
+	lookups = dcache_lookups;
+	hits = dcache_hits;
+	neghits = dcache_neghits;
+	enters = dcache_enters;
+	invalidations = dcache_invalidations;
+	evictions = dcache_evictions;
+	lock_release(dcache_lock);
+
+	kprintf("%20s: %u of %u\n", "entries", count, DCACHE_MAX);
+	kprintf("%20s: %u\n", "lookups", lookups);
+	kprintf("%20s: %u\n", "hits", hits);
+	kprintf("%20s: %u\n", "negative hits", neghits);
+	kprintf("%20s: %u\n", "misses", lookups - hits - neghits);
+	if (lookups > 0) {
+		kprintf("%20s: %u%%\n", "hit rate",
+			(hits + neghits) * 100 / lookups);
+	}
+	kprintf("%20s: %u\n", "enters", enters);
+	kprintf("%20s: %u\n", "invalidations", invalidations);
+	kprintf("%20s: %u\n", "evictions", evictions);
+}
+
+void
+dcache_resetstats(void)
+{
+	lock_acquire(dcache_lock);
+	dcache_lookups = 0;
+	dcache_hits = 0;
+	dcache_neghits = 0;
+	dcache_enters = 0;
+	dcache_invalidations = 0;
+	dcache_evictions = 0;
+	lock_release(dcache_lock);
+}
@@ -41,6 +41,8 @@
 #include <synch.h>
 #include <vfs.h>
 #include <fs.h>
+#include <buf.h>
+#include <dcache.h>
 #include <vnode.h>
 #include <device.h>
 
@@ -112,6 +114,9 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	buffer_bootstrap();
+	dcache_bootstrap();
+
 	devnull_create();
 	semfs_bootstrap();
 }
@@ -634,6 +639,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* the name cache holds vnodes; let go of them */
+	dcache_purge_fs(kd->kd_fs);
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -725,6 +733,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		dcache_purge_fs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
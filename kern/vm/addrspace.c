@@ -30,6 +30,8 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <uio.h>
+#include <vnode.h>
 #include <current.h>
 #include <machine/tlb.h>
 #include <machine/vm.h>
@@ -57,6 +59,9 @@ as_create(int pid)
 	 * Initialize as needed.
 	 */
 	as->pid = pid;
+	as->asid = 0;
+	as->asid_generation = 0;
+	as->tlb_cpus = 0;
 	as->pages = pagetable_create();
 
 	as->destroying = false;
@@ -67,6 +72,9 @@ as_create(int pid)
 	as->heap_end = 0;
 	as->heap_start = 0;
 	as->stack_base = (vaddr_t) -1;
+	as->fault_next = 0;
+	as->loading = false;
+	as->nregions = 0;
 
 	return as;
 }
@@ -108,10 +116,22 @@ as_copy(struct addrspace *old, struct addrspace **ret, int newpid)
 		return ENOMEM;
 	}
 
+	/* Our resident pages are now shared read-only; drop any writable mappings we still have cached */
+	vm_tlb_flush(old);
+
 	newas->heap_start = old->heap_start;
 	newas->heap_end = old->heap_end;
 	newas->stack_base = old->stack_base;
 
+	/* Pages the parent never touched are read from the executable in the child too */
+	for (unsigned i = 0; i < old->nregions; i++) {
+		newas->regions[i] = old->regions[i];
+		if (newas->regions[i].vnode != NULL) {
+			VOP_INCREF(newas->regions[i].vnode);
+		}
+	}
+	newas->nregions = old->nregions;
+
 	*ret = newas;
 	return 0;
 }
@@ -127,7 +147,7 @@ as_destroy(struct addrspace *as)
 	 * by other processes (due to swap conflicts) */
 	as->destroy_count = 0;
 	as->destroying = true;
-	int count = pagetable_free_all(as->pages);
+	int count = pagetable_free_all(as->pages, as->pid);
 
 	/* We wait until we're notified that all the other threads have finished destroying the extra pages */
 	lock_acquire(as->destroy_lock);
@@ -139,6 +159,12 @@ as_destroy(struct addrspace *as)
 
 	pagetable_destroy(as->pages);
 
+	for (unsigned i = 0; i < as->nregions; i++) {
+		if (as->regions[i].vnode != NULL) {
+			VOP_DECREF(as->regions[i].vnode);
+		}
+	}
+	as->nregions = 0;
 }
 
 void
@@ -155,11 +181,8 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
-	/* Invalidate all of the tlb entries */
-	vm_flush_tlb(as->pid);
+	/* Switch the TLB over to this address space's entries */
+	vm_tlb_activate(as);
 }
 
 void
@@ -178,52 +201,185 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. They
+ * are given to each page as it is first faulted in.
+ *
+ * No memory is allocated here; the segment is zero-filled on demand
+ * unless as_map_file attaches part of a file to it.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
-  uint8_t flags = 0;
-  if (executable > 0)
-  {
-    flags += 64;
-  }
-  if (writeable > 0)
-  {
-    flags += 32;
-  }
-  if (readable > 0)
-  {
-    flags += 16;
-  }
-  vaddr_t page = vaddr >> 12 << 12;
-  for(vaddr_t v = page; v < page + memsize; v += 4096)
-  {
-    struct pagetable_entry* resident = pagetable_lookup(as->pages, v);
-    while (resident == NULL)
-    {
-      paddr_t newaddr = pagetable_pull(as->pages, v, flags);
-      if (newaddr == 0)
-      {
-        return ENOMEM;
-      }
-      resident = pagetable_lookup(as->pages, v);
-    }
-    resident->flags = resident->flags % 16 + flags;
-  }
-
-    as->heap_start = (page + memsize);
-    if(as->heap_start & (4096 - 1))
-    {
-      as->heap_start = (as->heap_start + 4096) & (~(4096 - 1));
-    }
-    as->heap_end = as->heap_start;
+	/* Nothing copies the segment in any more, so check the bounds here */
+	if (vaddr + memsize < vaddr || vaddr + memsize > USERSTACK) {
+		return EFAULT;
+	}
+	if (as->nregions >= AS_MAX_REGIONS) {
+		return ENOMEM;
+	}
+
+	struct as_region *region = &as->regions[as->nregions++];
+	region->vbase = vaddr;
+	region->memsize = memsize;
+	region->vnode = NULL;
+	region->offset = 0;
+	region->filesize = 0;
+	region->flags = 0;
+	if (executable > 0) {
+		region->flags |= PAGETABLE_EXECUTABLE;
+	}
+	if (writeable > 0) {
+		region->flags |= PAGETABLE_WRITEABLE;
+	}
+	if (readable > 0) {
+		region->flags |= PAGETABLE_READABLE;
+	}
+
+	vaddr_t page = vaddr & PAGE_FRAME;
+	as->heap_start = (page + memsize);
+	if (as->heap_start & (PAGE_SIZE - 1)) {
+		as->heap_start = (as->heap_start + PAGE_SIZE) & PAGE_FRAME;
+	}
+	as->heap_end = as->heap_start;
+	return 0;
+}
+
+/*
+ * Back the first FILESIZE bytes of the region starting at VADDR with
+ * the file V from OFFSET on. The address space holds a reference to
+ * V until it is destroyed.
+ */
+int
+as_map_file(struct addrspace *as, vaddr_t vaddr,
+	    struct vnode *v, off_t offset, size_t filesize)
+{
+	for (unsigned i = 0; i < as->nregions; i++) {
+		struct as_region *region = &as->regions[i];
+		if (region->vbase != vaddr) {
+			continue;
+		}
+		if (filesize > region->memsize) {
+			return EINVAL;
+		}
+		VOP_INCREF(v);
+		if (region->vnode != NULL) {
+			VOP_DECREF(region->vnode);
+		}
+		region->vnode = v;
+		region->offset = offset;
+		region->filesize = filesize;
+		return 0;
+	}
+	return EINVAL;
+}
+
+struct as_region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	for (unsigned i = 0; i < as->nregions; i++) {
+		struct as_region *region = &as->regions[i];
+		if (vaddr >= region->vbase && vaddr - region->vbase < region->memsize) {
+			return &as->regions[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Fault in the page holding VADDR for the first time. Segments need
+ * not be page-aligned, so every region overlapping the page gets its
+ * say: its file bytes are read in and its permissions are added.
+ */
+int
+as_load_page(struct addrspace *as, vaddr_t vaddr)
+{
+	vaddr_t page = vaddr & PAGE_FRAME;
+	uint8_t flags = 0;
+	bool fromfile = false;
+	int result;
+
+	// the frame stays locked, so it can't be evicted while the file is read into it
+	paddr_t paddr = coremap_allocate_page(false, as->pid, 1, (userptr_t) page);
+	char *kpage = (char *) PADDR_TO_KVADDR(paddr);
+
+	for (unsigned i = 0; i < as->nregions; i++) {
+		struct as_region *region = &as->regions[i];
+		if (region->vbase >= page + PAGE_SIZE ||
+		    region->vbase + region->memsize <= page) {
+			continue;
+		}
+		flags |= region->flags;
+
+		// the part of the page that comes from the file; the rest stays zero
+		vaddr_t start = region->vbase > page ? region->vbase : page;
+		vaddr_t end = region->vbase + region->filesize;
+		if (end > page + PAGE_SIZE) {
+			end = page + PAGE_SIZE;
+		}
+		if (region->vnode == NULL || start >= end) {
+			continue;
+		}
+
+		struct iovec iov;
+		struct uio ku;
+		uio_kinit(&iov, &ku, kpage + (start - page), end - start,
+			  region->offset + (start - region->vbase), UIO_READ);
+		result = VOP_READ(region->vnode, &ku);
+		if (result == 0 && ku.uio_resid != 0) {
+			/* short read; the executable was truncated under us */
+			result = ENOEXEC;
+		}
+		if (result) {
+			coremap_free_page(paddr);
+			return result;
+		}
+		fromfile = true;
+	}
+
+	if (!pagetable_add(as->pages, page, paddr, flags)) {
+		coremap_free_page(paddr);
+		return ENOMEM;
+	}
+	// nothing else holds these contents once the frame is evicted, so it must go to swap
+	coremap_mark_page_dirty(paddr);
+	coremap_lock_release(paddr);
+
+	vmstat_inc(fromfile ? VMSTAT_EXEC_PAGEINS : VMSTAT_ZERO_FILLS);
+	return 0;
+}
+
+/*
+ * Load every page of a file-backed region in [VADDR, VADDR+LEN) that
+ * hasn't been touched yet. Once loaded, a page goes to swap when it is
+ * evicted, so later faults on the range never read the executable.
+ * System calls that hand user buffers to VOP_READ/VOP_WRITE call this
+ * first: a fault taken there would read the executable while the file
+ * system holds the vnode, buffer and disk locks the load also needs.
+ * Addresses outside the regions are left to fault (or fail) as usual.
+ */
+int
+as_prefault(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	if (len == 0) {
+		return 0;
+	}
+	vaddr_t last = vaddr + len - 1;
+	if (last < vaddr || last >= USERSTACK) {
+		/* not a user range; the copy itself will report it */
+		return 0;
+	}
+
+	for (vaddr_t page = vaddr & PAGE_FRAME; page <= last; page += PAGE_SIZE) {
+		if (as_find_region(as, page) == NULL ||
+		    pagetable_lookup(as->pages, page) != NULL) {
+			continue;
+		}
+		int result = as_load_page(as, page);
+		if (result) {
+			return result;
+		}
+	}
 	return 0;
 }
 
@@ -247,7 +403,7 @@ as_complete_load(struct addrspace *as)
 
 	// revoke special writing privileges; then flush the TLB
 	as->loading = false;
-	vm_flush_tlb(0);
+	vm_tlb_flush(as);
 	return 0;
 }
 
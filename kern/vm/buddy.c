@@ -0,0 +1,150 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <buddy.h>
+
+#define BUDDY_NONE ((unsigned int) -1)
+#define BUDDY_NOT_HEAD 0xff
+
+static struct buddy_node *buddy_nodes = NULL;
+static unsigned int buddy_nframes = 0;
+static unsigned int buddy_heads[BUDDY_MAX_ORDER + 1];
+
+static
+void
+buddy_push(unsigned int idx, unsigned int order){
+	buddy_nodes[idx].order = order;
+	buddy_nodes[idx].prev = BUDDY_NONE;
+	buddy_nodes[idx].next = buddy_heads[order];
+	if(buddy_heads[order] != BUDDY_NONE){
+		buddy_nodes[buddy_heads[order]].prev = idx;
+	}
+	buddy_heads[order] = idx;
+}
+
+static
+void
+buddy_unlink(unsigned int idx){
+	struct buddy_node *node = &buddy_nodes[idx];
+	KASSERT(node->order <= BUDDY_MAX_ORDER);
+
+	if(node->prev == BUDDY_NONE){
+		buddy_heads[node->order] = node->next;
+	} else {
+		buddy_nodes[node->prev].next = node->next;
+	}
+	if(node->next != BUDDY_NONE){
+		buddy_nodes[node->next].prev = node->prev;
+	}
+	node->order = BUDDY_NOT_HEAD;
+}
+
+// frees one aligned block, merging it with its buddy for as long as the buddy is free too
+static
+void
+buddy_free_block(unsigned int idx, unsigned int order){
+	while(order < BUDDY_MAX_ORDER){
+		unsigned int buddy = idx ^ (1 << order);
+		if(buddy + (1 << order) > buddy_nframes || buddy_nodes[buddy].order != order){
+			break;
+		}
+		buddy_unlink(buddy);
+		if(buddy < idx){
+			idx = buddy;
+		}
+		order++;
+	}
+	buddy_push(idx, order);
+}
+
+void
+buddy_bootstrap(struct buddy_node *nodes, unsigned int nframes){
+	buddy_nodes = nodes;
+	buddy_nframes = nframes;
+	for(unsigned int i = 0; i <= BUDDY_MAX_ORDER; i++){
+		buddy_heads[i] = BUDDY_NONE;
+	}
+	for(unsigned int i = 0; i < nframes; i++){
+		nodes[i].next = BUDDY_NONE;
+		nodes[i].prev = BUDDY_NONE;
+		nodes[i].order = BUDDY_NOT_HEAD;
+	}
+}
+
+int
+buddy_alloc(unsigned int npages, unsigned int *idx){
+	KASSERT(npages > 0);
+
+	unsigned int order = 0;
+	while((1u << order) < npages){
+		order++;
+	}
+	if(order > BUDDY_MAX_ORDER){
+		return ENOSPC;
+	}
+
+	// smallest free block that is big enough
+	unsigned int found = order;
+	while(found <= BUDDY_MAX_ORDER && buddy_heads[found] == BUDDY_NONE){
+		found++;
+	}
+	if(found > BUDDY_MAX_ORDER){
+		return ENOSPC;
+	}
+
+	unsigned int block = buddy_heads[found];
+	buddy_unlink(block);
+
+	// split it down, putting the upper halves back
+	while(found > order){
+		found--;
+		buddy_push(block + (1 << found), found);
+	}
+
+	// and give back whatever is left over past npages
+	if((1u << order) > npages){
+		buddy_free(block + npages, (1 << order) - npages);
+	}
+
+	*idx = block;
+	return 0;
+}
+
+void
+buddy_free(unsigned int idx, unsigned int npages){
+	KASSERT(idx + npages <= buddy_nframes);
+
+	// carve the run into the largest aligned blocks that fit
+	while(npages > 0){
+		unsigned int order = 0;
+		while(order < BUDDY_MAX_ORDER && (idx & (1 << order)) == 0 && (2u << order) <= npages){
+			order++;
+		}
+		buddy_free_block(idx, order);
+		idx += 1 << order;
+		npages -= 1 << order;
+	}
+}
+
+void
+buddy_claim(unsigned int idx){
+	KASSERT(idx < buddy_nframes);
+
+	// find the free block containing the frame
+	for(unsigned int order = 0; order <= BUDDY_MAX_ORDER; order++){
+		unsigned int head = idx & ~((1u << order) - 1);
+		if(buddy_nodes[head].order == order){
+			buddy_unlink(head);
+			// free what lies on either side of the frame again
+			if(idx > head){
+				buddy_free(head, idx - head);
+			}
+			if(head + (1 << order) > idx + 1){
+				buddy_free(idx + 1, head + (1 << order) - (idx + 1));
+			}
+			return;
+		}
+	}
+
+	panic("buddy_claim: frame %u is not free\n", idx);
+}
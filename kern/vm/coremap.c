@@ -11,11 +11,50 @@
 #include <coremap.h>
 #include <swap.h>
 #include <vm.h>
+#include <thread.h>
+#include <cpu.h>
+#include <current.h>
+#include <spl.h>
+#include <buddy.h>
 
+// contention counters for the coremap spinlock, protected by the lock itself
+static unsigned int coremap_lock_acquires = 0;
+static unsigned int coremap_lock_contended = 0;
+
+static
+void
+coremap_spinlock_acquire(void){
+	// a racy peek, but good enough to tell whether we are about to spin
+	bool busy = spinlock_data_get(&coremap_spinlock.splk_lock) != 0;
+	spinlock_acquire(&coremap_spinlock);
+	coremap_lock_acquires++;
+	if(busy){
+		coremap_lock_contended++;
+	}
+}
+
+// takes npages contiguous free frames from the buddy allocator, claiming them in both bitmaps
+static
+int
+locate_block(unsigned npages, unsigned int *result){
+	coremap_spinlock_acquire();
+	int err = buddy_alloc(npages, result);
+	if(!err){
+		for(unsigned int i = 0; i < npages; i++){
+			bitmap_mark(coremap_free, *result + i);
+			bitmap_mark(coremap_swappable, *result + i);
+		}
+		coremap_free_count -= npages;
+	}
+	spinlock_release(&coremap_spinlock);
+	return err;
+}
+
+// first fit over the given map; only used to find a range of evictable frames now
 static
 int
 locate_range(struct bitmap *map, unsigned npages, unsigned int *result){
-	spinlock_acquire(&coremap_spinlock);
+	coremap_spinlock_acquire();
 
 	unsigned int min = 0;
 	while(min < coremap_length){
@@ -52,6 +91,8 @@ locate_range(struct bitmap *map, unsigned npages, unsigned int *result){
 			for(unsigned int i = 0; i < npages; i++){
 				if(!bitmap_isset(coremap_free, idx + i)){
 					bitmap_mark(coremap_free, idx + i);
+					buddy_claim(idx + i);
+					coremap_free_count--;
 				}
 				if(!bitmap_isset(coremap_swappable, idx + i)){
 					bitmap_mark(coremap_swappable, idx + i);
@@ -67,23 +108,115 @@ locate_range(struct bitmap *map, unsigned npages, unsigned int *result){
 	return ENOSPC;
 }
 
-// locates a random page to swap out
+// replacement policy and clock hand, both protected by the coremap spinlock
+static int coremap_policy = COREMAP_POLICY_CLOCK;
+static unsigned int clock_hand = 0;
+
+/* The pageout daemon is woken once fewer than PAGEOUT_LOW_WATER frames are free, and evicts
+ * batches of up to PAGEOUT_BATCH pages until PAGEOUT_HIGH_WATER frames are free again. */
+#define PAGEOUT_LOW_WATER (coremap_length / 32 + 4)
+#define PAGEOUT_HIGH_WATER (coremap_length / 16 + 8)
+#define PAGEOUT_BATCH SWAP_CLUSTER_MAX
+
+static struct semaphore *pageout_sem = NULL;
+static bool pageout_requested = false;
+
+static void coremap_release_frames(paddr_t paddr, bool cacheable);
+
+// hands out a free frame, if there is one, claiming it in both bitmaps
 static
-int
-locate_random(unsigned int *idx){
-	spinlock_acquire(&coremap_spinlock);
-	// first, see if there is a free page
-	if(!bitmap_alloc(coremap_free, idx)){
+bool
+locate_free(unsigned int *idx){
+	KASSERT(spinlock_do_i_hold(&coremap_spinlock));
+	if(buddy_alloc(1, idx)){
+		return false;
+	}
+	bitmap_mark(coremap_free, *idx);
+	bitmap_mark(coremap_swappable, *idx);
+	coremap_free_count--;
+	return true;
+}
+
+/* Per-cpu free-frame caches. Cached frames stay marked in both bitmaps, so the rest of the
+ * coremap sees them as allocated and pinned, and are left out of coremap_free_count; the
+ * pageout watermarks add them back in through cpu_cachedframes. A cpu
+ * that runs dry takes FRAMECACHE_BATCH frames under one acquisition of the coremap spinlock;
+ * one that fills up gives back the same number. */
+#define FRAMECACHE_BATCH (FRAMECACHE_MAX / 2)
+
+// takes a free frame from this cpu's cache, refilling it if empty
+static
+bool
+framecache_get(unsigned int *idx){
+	int spl = splhigh();
+	struct cpu *c = curcpu->c_self;
+
+	if(c->c_numframes == 0){
+		coremap_spinlock_acquire();
+		while(c->c_numframes < FRAMECACHE_BATCH && locate_free(&c->c_frames[c->c_numframes])){
+			c->c_numframes++;
+		}
 		spinlock_release(&coremap_spinlock);
-		return 0;
+		if(c->c_numframes > 0){
+			vmstat_inc(VMSTAT_FRAME_REFILLS);
+		}
+	}
+
+	bool found = c->c_numframes > 0;
+	if(found){
+		*idx = c->c_frames[--c->c_numframes];
+	}
+	splx(spl);
+	return found;
+}
+
+// puts a freed frame in this cpu's cache; returns false if it should go straight back to the coremap
+static
+bool
+framecache_put(unsigned int idx){
+	// only frames pinned by their last user can be cached without touching the bitmaps
+	if(!bitmap_isset(coremap_swappable, idx)){
+		return false;
+	}
+
+	int spl = splhigh();
+	struct cpu *c = curcpu->c_self;
+
+	// don't sit on frames while memory is short; someone may be waiting for them
+	// (an unlocked read; being off by a frame or two here does no harm)
+	if(coremap_free_count < PAGEOUT_LOW_WATER){
+		splx(spl);
+		return false;
 	}
 
+	if(c->c_numframes == FRAMECACHE_MAX){
+		coremap_spinlock_acquire();
+		for(unsigned int i = 0; i < FRAMECACHE_BATCH; i++){
+			unsigned int drop = c->c_frames[--c->c_numframes];
+			bitmap_unmark(coremap_swappable, drop);
+			bitmap_unmark(coremap_free, drop);
+			buddy_free(drop, 1);
+			coremap_free_count++;
+		}
+		spinlock_release(&coremap_spinlock);
+		vmstat_inc(VMSTAT_FRAME_DRAINS);
+	}
+
+	c->c_frames[c->c_numframes++] = idx;
+	splx(spl);
+	return true;
+}
+
+// locates a random page to swap out
+static
+int
+locate_random(unsigned int *idx){
+	KASSERT(spinlock_do_i_hold(&coremap_spinlock));
 	struct bitmap *map = coremap_swappable;
 
 	// check that there is some space in the swappable map
 	int err = bitmap_alloc(map, idx);
 	if(err){
-		spinlock_release(&coremap_spinlock);
 		return err;
 	}
 	bitmap_unmark(map, *idx);
@@ -94,8 +227,8 @@ locate_random(unsigned int *idx){
 	for(unsigned int i = 0; i < num_rand; i++){
 		rand = random() % coremap_length;
 		if(!bitmap_isset(map, rand)){
+			bitmap_mark(map, rand);
 			*idx = rand;
-			spinlock_release(&coremap_spinlock);
 			return 0;
 		}
 	}
@@ -105,56 +238,287 @@ locate_random(unsigned int *idx){
 		rand = random() % coremap_length;
 		err = bitmap_alloc_after(map, rand, idx);
 		if(!err){
-			spinlock_release(&coremap_spinlock);
 			return err;
 		}
 	}
 
 	// give up and return the first available space
-	err = bitmap_alloc(map, idx);
+	return bitmap_alloc(map, idx);
+}
 
-	spinlock_release(&coremap_spinlock);
+/* The reference bit is only set when a page's TLB entry is loaded, so clearing it means
+ * nothing while the entry stays in a TLB: a hot page would never fault to set it again.
+ * Each page whose bit a sweep clears is recorded here, and its mapping is shot down once
+ * the coremap spinlock is dropped. A sweep that runs out of room stops with EAGAIN, and
+ * carries on from the same page after the shootdowns. */
+#define REFCLEAR_BATCH TLBSHOOTDOWN_MAX
+
+struct refclear {
+	unsigned int n;
+	uint16_t pids[REFCLEAR_BATCH];
+	userptr_t vaddrs[REFCLEAR_BATCH];
+};
+
+// clears a page's reference bit, if there's room to shoot its mapping down afterwards
+static
+bool
+refclear_take(struct refclear *rc, unsigned int idx){
+	KASSERT(spinlock_do_i_hold(&coremap_spinlock));
+	if(rc->n == REFCLEAR_BATCH){
+		return false;
+	}
+	coremap[idx].flags &= ~(COREMAP_REFERENCED);
+	rc->pids[rc->n] = coremap[idx].pid;
+	rc->vaddrs[rc->n] = coremap[idx].vaddr;
+	rc->n++;
+	vmstat_inc(VMSTAT_REF_CLEARS);
+	return true;
+}
+
+/* Shoots down the recorded mappings, one batch per owner. A page may have changed hands
+ * since; invalidating a mapping that's no longer there, or someone else's, only costs a
+ * TLB refill. */
+static
+void
+refclear_shootdown(struct refclear *rc){
+	bool done[REFCLEAR_BATCH];
+	vaddr_t addrs[REFCLEAR_BATCH];
+
+	for(unsigned int i = 0; i < rc->n; i++){
+		done[i] = false;
+	}
+
+	for(unsigned int i = 0; i < rc->n; i++){
+		if(done[i]){
+			continue;
+		}
+		unsigned int m = 0;
+		for(unsigned int j = i; j < rc->n; j++){
+			if(!done[j] && rc->pids[j] == rc->pids[i]){
+				addrs[m++] = (vaddr_t) rc->vaddrs[j];
+				done[j] = true;
+			}
+		}
 
+		struct proc *proc = proc_lookup(rc->pids[i]);
+		if(proc == NULL){
+			continue;
+		}
+		spinlock_acquire(&proc->p_lock);
+		struct addrspace *as = proc->p_addrspace;
+		spinlock_release(&proc->p_lock);
+		if(as != NULL){
+			vm_tlbshootdown_pages(as, addrs, m);
+		}
+		proc_release(proc);
+	}
+}
+
+/* Second-chance clock: sweep the hand over the frames, clearing the reference bit of
+ * each evictable page it passes, and take the first one that hasn't been referenced since
+ * the last sweep. Two full revolutions always find a victim if any page is evictable. */
+static
+int
+locate_clock(unsigned int *idx, struct refclear *rc){
+	KASSERT(spinlock_do_i_hold(&coremap_spinlock));
+	for(unsigned int n = 0; n < 2 * coremap_length; n++){
+		unsigned int i = clock_hand;
+		clock_hand = (clock_hand + 1) % coremap_length;
+
+		// kernel pages and pages mid-swap are held in the swappable map
+		if(bitmap_isset(coremap_swappable, i)){
+			continue;
+		}
+
+		if(coremap[i].flags & COREMAP_REFERENCED){
+			if(!refclear_take(rc, i)){
+				// come back to this page once the ones cleared so far are shot down
+				clock_hand = i;
+				return EAGAIN;
+			}
+			continue;
+		}
+
+		bitmap_mark(coremap_swappable, i);
+		*idx = i;
+		return 0;
+	}
+
+	return ENOSPC;
+}
+
+/* Aging: shift each evictable page's reference bit into the top of its age byte and
+ * evict the page with the smallest age, i.e. the one least used over the last 8 sweeps.
+ * A sweep interrupted for shootdowns resumes at aging_hand. */
+static unsigned int aging_hand = 0;
+
+static
+int
+locate_aging(unsigned int *idx, struct refclear *rc){
+	KASSERT(spinlock_do_i_hold(&coremap_spinlock));
+	for(; aging_hand < coremap_length; aging_hand++){
+		unsigned int i = aging_hand;
+		if(bitmap_isset(coremap_swappable, i)){
+			continue;
+		}
+
+		if(coremap[i].flags & COREMAP_REFERENCED){
+			if(!refclear_take(rc, i)){
+				return EAGAIN;
+			}
+			coremap[i].age = (coremap[i].age >> 1) | 0x80;
+		} else {
+			coremap[i].age >>= 1;
+		}
+	}
+	aging_hand = 0;
+
+	bool found = false;
+	unsigned int victim = 0;
+	for(unsigned int i = 0; i < coremap_length; i++){
+		if(bitmap_isset(coremap_swappable, i)){
+			continue;
+		}
+
+		if(!found || coremap[i].age < coremap[victim].age){
+			victim = i;
+			found = true;
+		}
+	}
+
+	if(!found){
+		return ENOSPC;
+	}
+
+	bitmap_mark(coremap_swappable, victim);
+	*idx = victim;
+	return 0;
+}
+
+// abstraction for the cache eviction policy; picks a resident page, never a free frame
+static int 
+locate_victim(unsigned int *idx){
+	struct refclear rc;
+	int err;
+	do{
+		rc.n = 0;
+		coremap_spinlock_acquire();
+		switch(coremap_policy){
+		case COREMAP_POLICY_RANDOM:
+			err = locate_random(idx);
+			break;
+		case COREMAP_POLICY_AGING:
+			err = locate_aging(idx, &rc);
+			break;
+		default:
+			err = locate_clock(idx, &rc);
+			break;
+		}
+		spinlock_release(&coremap_spinlock);
+
+		// shootdowns may send interrupts to other cpus, so they wait for the spinlock to go
+		refclear_shootdown(&rc);
+	} while(err == EAGAIN);
 	return err;
 }
 
-// abstraction for the cache eviction policy
+// finds a frame to bring a page into: a free one if possible, otherwise a victim to evict
 static int 
 locate_swap(unsigned int *idx){
-	return locate_random(idx);
+	if(framecache_get(idx)){
+		return 0;
+	}
+
+	vmstat_inc(VMSTAT_DIRECT_EVICTIONS);
+	return locate_victim(idx);
 }
 
-static 
+// wakes the pageout daemon if free memory has dropped below the low-water mark
+static
 void
-coremap_swap_page_out(unsigned int core_idx){	
+pageout_poke(void){
+	bool wake = false;
+	unsigned int cached = 0;
+	// the caches only matter when the shared pool alone is low (an unlocked read)
+	if(coremap_free_count < PAGEOUT_LOW_WATER){
+		cached = cpu_cachedframes();
+	}
+	coremap_spinlock_acquire();
+	if(pageout_sem != NULL && !pageout_requested && coremap_free_count + cached < PAGEOUT_LOW_WATER){
+		pageout_requested = true;
+		wake = true;
+	}
+	spinlock_release(&coremap_spinlock);
+
+	if(wake){
+		V(pageout_sem);
+	}
+}
+
+/* Eviction is split in two so the pageout daemon can write a whole batch of pages between
+ * the halves. swap_out_begin marks the page clean and, if it was dirty, hands back the disk
+ * block it has to be written to; swap_out_finish marks the page as no longer in memory.
+ * Returns NULL if the owner is gone, or if the owning page table no longer has an entry for
+ * the page; the frame is simply freed then. Otherwise the owner comes back in proc_ret with a
+ * reference, which keeps it and its address space around until the caller releases it after
+ * swap_out_finish. An exiting owner's address space is still found while as_destroy waits for
+ * the pages we hold, so those always reach swap_out_finish. The caller shoots a dirty page down
+ * from the TLBs before writing it, so that later writes fault and dirty it again, and every
+ * page after swap_out_finish. */
+static
+struct pagetable_entry *
+swap_out_begin(unsigned int core_idx, struct proc **proc_ret, struct addrspace **as_ret, bool *dirty,
+		unsigned int *disk_idx){
 	userptr_t vaddr = coremap[core_idx].vaddr;
 
-	struct proc *proc = pid_get_proc(pids, coremap[core_idx].pid);
+	struct proc *proc = proc_lookup(coremap[core_idx].pid);
+	if(proc == NULL)
+		return NULL;
 	spinlock_acquire(&proc->p_lock);
-	struct addrspace *as = proc->p_addrspace;
+	struct addrspace *as = proc->p_addrspace != NULL ? proc->p_addrspace : proc->p_oldas;
 	spinlock_release(&proc->p_lock);
+	if(as == NULL){
+		proc_release(proc);
+		return NULL;
+	}
+
 	struct pagetable_entry *entry = pagetable_lookup(as->pages, (vaddr_t) vaddr);
-	if(entry == NULL)
-		return;
+	if(entry == NULL){
+		proc_release(proc);
+		return NULL;
+	}
+
+	vmstat_inc(VMSTAT_EVICTIONS);
+	if(coremap[core_idx].flags & COREMAP_PREFETCHED){
+		vmstat_inc(VMSTAT_PREFETCH_WASTED);
+	}
 
+	*proc_ret = proc;
+	*as_ret = as;
+	*dirty = false;
 	if(coremap[core_idx].flags & COREMAP_DIRTY){
-		spinlock_acquire(&entry->lock);
-		unsigned int disk_idx = entry->swap;
+		// the block was reserved when the page was mapped, so there must be one to give
+		if(pagetable_assign_swap(as->pages, entry, (vaddr_t) vaddr)){
+			panic("Swap reservation exceeded; no free swap block\n");
+		}
+		pagetable_lock_entry(as->pages, (vaddr_t) vaddr);
+		*disk_idx = entry->swap;
 		entry->flags &= ~(PAGETABLE_DIRTY);
 		coremap[core_idx].flags &= ~(COREMAP_DIRTY);
-		spinlock_release(&entry->lock);
-
-		// shootdown happens outside the spinlock, as it is sending interrupts to everyone (including curcpu)
-		vm_tlbshootdown_all((vaddr_t) coremap[core_idx].vaddr);
-
-		paddr_t paddr = coremap_untranslate(core_idx);
-		void* kvaddr = (void*) PADDR_TO_KVADDR(paddr);
-		swap_page_out(kvaddr, disk_idx);
+		pagetable_unlock_entry(as->pages, (vaddr_t) vaddr);
+		*dirty = true;
 	}
 
+	return entry;
+}
+
+static
+void
+swap_out_finish(unsigned int core_idx, struct addrspace *as, struct pagetable_entry *entry){
 	// notify address space if its waiting to destroy safely
+	vaddr_t vaddr = (vaddr_t) coremap[core_idx].vaddr;
 	lock_acquire(as->destroy_lock);
-	spinlock_acquire(&entry->lock);
+	pagetable_lock_entry(as->pages, vaddr);
 	if(as->destroying && (entry->flags & PAGETABLE_REQUEST_DESTROY)){
 		as->destroy_count--;
 		cv_signal(as->destroy_cv, as->destroy_lock);
@@ -168,29 +532,212 @@ coremap_swap_page_out(unsigned int core_idx){
 
 	// free disk and invalidate entirely if requested
 	if(entry->flags & PAGETABLE_REQUEST_FREE){
-		swap_free(entry->swap);
+		swap_discard(entry->swap);
 		entry->flags &= ~PAGETABLE_VALID;
 	}
 
-	spinlock_release(&entry->lock);
+	pagetable_unlock_entry(as->pages, vaddr);
+}
+
+/* Shoots down the victims' pages, for those given an address space, with one batch of
+ * shootdowns per address space */
+static
+void
+coremap_shootdown(struct addrspace **spaces, unsigned int *victims, unsigned int n){
+	bool done[PAGEOUT_BATCH];
+	vaddr_t addrs[PAGEOUT_BATCH];
+
+	KASSERT(n <= PAGEOUT_BATCH);
+	for(unsigned int i = 0; i < n; i++){
+		done[i] = (spaces[i] == NULL);
+	}
+
+	for(unsigned int i = 0; i < n; i++){
+		if(done[i]){
+			continue;
+		}
+		unsigned int m = 0;
+		for(unsigned int j = i; j < n; j++){
+			if(!done[j] && spaces[j] == spaces[i]){
+				addrs[m++] = (vaddr_t) coremap[victims[j]].vaddr;
+				done[j] = true;
+			}
+		}
+		vm_tlbshootdown_pages(spaces[i], addrs, m);
+	}
+}
+
+static 
+void
+coremap_swap_page_out(unsigned int core_idx){	
+	struct proc *proc;
+	struct addrspace *as;
+	bool dirty;
+	unsigned int disk_idx;
+	struct pagetable_entry *entry = swap_out_begin(core_idx, &proc, &as, &dirty, &disk_idx);
+	if(entry == NULL)
+		return;
+
+	vaddr_t vaddr = (vaddr_t) coremap[core_idx].vaddr;
+	if(dirty){
+		// shootdown happens outside the spinlocks, as it may send interrupts to other cpus
+		vm_tlbshootdown_page(as, vaddr);
+		paddr_t paddr = coremap_untranslate(core_idx);
+		void* kvaddr = (void*) PADDR_TO_KVADDR(paddr);
+		swap_page_out(kvaddr, disk_idx);
+	}
+
+	swap_out_finish(core_idx, as, entry);
+	vm_tlbshootdown_page(as, vaddr);
+	proc_release(proc);
+}
+
+/* Evicts a batch of pages picked by the replacement policy, writing their dirty contents out
+ * in runs of adjacent swap blocks, and returns the frames to the free pool. */
+static
+void
+coremap_evict_batch(unsigned int *victims, unsigned int n){
+	struct proc *procs[PAGEOUT_BATCH];
+	struct addrspace *spaces[PAGEOUT_BATCH];
+	struct addrspace *dirty_spaces[PAGEOUT_BATCH];
+	struct pagetable_entry *entries[PAGEOUT_BATCH];
+	unsigned int blocks[PAGEOUT_BATCH];
+	unsigned int order[PAGEOUT_BATCH];
+	unsigned int ndirty = 0;
+
+	KASSERT(n <= PAGEOUT_BATCH);
+
+	for(unsigned int i = 0; i < n; i++){
+		bool dirty;
+		entries[i] = swap_out_begin(victims[i], &procs[i], &spaces[i], &dirty, &blocks[i]);
+		if(entries[i] == NULL){
+			procs[i] = NULL;
+			spaces[i] = NULL;
+		}
+		dirty_spaces[i] = (entries[i] != NULL && dirty) ? spaces[i] : NULL;
+		if(dirty_spaces[i] != NULL){
+			// insertion sort the dirty pages by disk block
+			unsigned int j = ndirty++;
+			while(j > 0 && blocks[order[j - 1]] > blocks[i]){
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = i;
+		}
+	}
+
+	// stop writes to the dirty pages before they go out
+	coremap_shootdown(dirty_spaces, victims, n);
+
+	// one write for each run of consecutive disk blocks
+	void *kvaddrs[PAGEOUT_BATCH];
+	unsigned int run = 0;
+	for(unsigned int i = 0; i < ndirty; i++){
+		unsigned int v = order[i];
+		kvaddrs[run++] = (void*) PADDR_TO_KVADDR(coremap_untranslate(victims[v]));
+		if(i + 1 == ndirty || blocks[order[i + 1]] != blocks[v] + 1){
+			swap_pages_out(kvaddrs, blocks[v] + 1 - run, run);
+			run = 0;
+		}
+	}
+
+	for(unsigned int i = 0; i < n; i++){
+		if(entries[i] != NULL){
+			swap_out_finish(victims[i], spaces[i], entries[i]);
+		}
+	}
+	coremap_shootdown(spaces, victims, n);
+	for(unsigned int i = 0; i < n; i++){
+		if(procs[i] != NULL){
+			proc_release(procs[i]);
+		}
+	}
+
+	// straight back to the shared pool, where the watermarks and every cpu can see them
+	for(unsigned int i = 0; i < n; i++){
+		coremap_release_frames(coremap_untranslate(victims[i]), false);
+	}
+}
+
+static
+int
+pageout_thread(void *data1, unsigned long data2){
+	(void) data1;
+	(void) data2;
+
+	unsigned int victims[PAGEOUT_BATCH];
+	while(true){
+		P(pageout_sem);
+
+		while(true){
+			// frames in the cpus' caches are free too, just not in the shared pool
+			unsigned int free = cpu_cachedframes();
+			coremap_spinlock_acquire();
+			free += coremap_free_count;
+			spinlock_release(&coremap_spinlock);
+			unsigned int want = 0;
+			if(free < PAGEOUT_HIGH_WATER){
+				want = PAGEOUT_HIGH_WATER - free;
+			}
+			if(want > PAGEOUT_BATCH){
+				want = PAGEOUT_BATCH;
+			}
+
+			unsigned int n = 0;
+			while(n < want && !locate_victim(&victims[n])){
+				n++;
+			}
+			if(n == 0){
+				break;
+			}
+
+			vmstat_inc(VMSTAT_PAGEOUT_BATCHES);
+			coremap_evict_batch(victims, n);
+		}
+
+		coremap_spinlock_acquire();
+		pageout_requested = false;
+		spinlock_release(&coremap_spinlock);
+	}
+
+	return 0;
+}
+
+void
+coremap_pageout_start(void){
+	pageout_sem = sem_create("PAGEOUT", 0);
+	if(pageout_sem == NULL){
+		panic("Unable to create the pageout semaphore.\n");
+	}
 
-	vm_tlbshootdown_all((vaddr_t) coremap[core_idx].vaddr);
+	int err = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if(err){
+		panic("Unable to start the pageout daemon: %s\n", strerror(err));
+	}
 }
 
 paddr_t
 coremap_allocate_page(bool iskern, int pid, int npages, userptr_t vaddr){
 	
 	unsigned int idx;
-	int err = locate_range(coremap_free, npages, &idx);
+	int err;
+	if(npages == 1){
+		err = framecache_get(&idx) ? 0 : ENOSPC;
+	} else {
+		err = locate_block(npages, &idx);
+	}
 	if(!err){
 		for(int i = 0; i < npages; i++){
 			coremap[idx + i].pid = pid;
+			coremap[idx + i].age = 0;
+			coremap[idx + i].refs = iskern ? 0 : 1;
+			coremap[idx + i].pins = 0;
 			coremap[idx + i].flags = COREMAP_INUSE;
 			if(i > 0){
 				coremap[idx + i].flags |= COREMAP_MULTI;
 			}
 			if(!iskern){
-				coremap[idx + i].flags |= COREMAP_SWAPPABLE;
+				coremap[idx + i].flags |= COREMAP_SWAPPABLE | COREMAP_REFERENCED;
 				coremap[idx + i].vaddr = vaddr;
 			} else {
 				coremap[idx + i].vaddr = 0;
@@ -200,15 +747,19 @@ coremap_allocate_page(bool iskern, int pid, int npages, userptr_t vaddr){
 			memset(kvaddr, 0, PAGE_SIZE);
 		}
 
+		pageout_poke();
 		return coremap_untranslate(idx);
 	}
 
+	// the pageout daemon hasn't kept up; evict synchronously
+	vmstat_inc(VMSTAT_DIRECT_EVICTIONS);
+
 	while(locate_range(coremap_swappable, npages, &idx)){
 		cv_wait(coremap_cv, coremap_lock);
 	}
 
 	for(int i = 0; i < npages; i++){
-		if(coremap[idx + i].flags | COREMAP_INUSE){
+		if(coremap[idx + i].flags & COREMAP_INUSE){
 			coremap_swap_page_out(idx + i);
 		}
 
@@ -218,9 +769,12 @@ coremap_allocate_page(bool iskern, int pid, int npages, userptr_t vaddr){
 
 		// set new coremap values
 		coremap[idx + i].pid = pid;
+		coremap[idx + i].age = 0;
+		coremap[idx + i].refs = iskern ? 0 : 1;
+		coremap[idx + i].pins = 0;
 		coremap[idx + i].flags = COREMAP_INUSE;
 		if(!iskern){
-			coremap[idx + i].flags |= COREMAP_SWAPPABLE;
+			coremap[idx + i].flags |= COREMAP_SWAPPABLE | COREMAP_REFERENCED;
 			coremap[idx + i].vaddr = vaddr;
 		} else{
 			coremap[idx + i].vaddr = 0;
@@ -230,31 +784,52 @@ coremap_allocate_page(bool iskern, int pid, int npages, userptr_t vaddr){
 		}
 	}
 
+	pageout_poke();
 	return coremap_untranslate(idx);
 }
 
 paddr_t 
 coremap_swap_page(unsigned int diskblock, userptr_t vaddr, int pid){
+	paddr_t paddr = coremap_swap_frame(vaddr, pid, false);
+	swap_page_in((void*) PADDR_TO_KVADDR(paddr), diskblock);
+	return paddr;
+}
+
+paddr_t
+coremap_swap_frame(userptr_t vaddr, int pid, bool prefetch){
 	unsigned int idx;
-	// wait for a free page ? return error ?
-	while(locate_swap(&idx)){
-		cv_wait(coremap_cv, coremap_lock);
-	}
+	if(prefetch){
+		if(!framecache_get(&idx)){
+			return 0;
+		}
+	} else {
+		// wait for a free page ? return error ?
+		while(locate_swap(&idx)){
+			cv_wait(coremap_cv, coremap_lock);
+		}
 	
-	coremap_swap_page_out(idx);
+		if(coremap[idx].flags & COREMAP_INUSE){
+			coremap_swap_page_out(idx);
+		}
+	}
 
-	paddr_t paddr = coremap_untranslate(idx);
-	swap_page_in((void*) PADDR_TO_KVADDR(paddr), diskblock);
-	
 	coremap[idx].pid = pid;
 	coremap[idx].vaddr = vaddr;
 	coremap[idx].flags = COREMAP_INUSE | COREMAP_SWAPPABLE;
+	// a prefetched page only counts as referenced once it is actually faulted on
+	coremap[idx].flags |= prefetch ? COREMAP_PREFETCHED : COREMAP_REFERENCED;
+	coremap[idx].age = 0;
+	coremap[idx].refs = 1;
+	coremap[idx].pins = 0;
 
-	return paddr;
+	pageout_poke();
+	return coremap_untranslate(idx);
 }
 
-void 
-coremap_free_page(paddr_t paddr){
+/* Frees an allocation; a single frame goes to this cpu's cache if cacheable and there's room */
+static
+void
+coremap_release_frames(paddr_t paddr, bool cacheable){
 	// determine length of original allocation
 	int idx = coremap_translate(paddr);
 	int num = 1;
@@ -265,15 +840,26 @@ coremap_free_page(paddr_t paddr){
 	// now un-set the coremap use flags
 	for(int i = 0; i < num; i++){
 		coremap[idx + i].flags = 0;
+		coremap[idx + i].age = 0;
+		coremap[idx + i].refs = 0;
+		coremap[idx + i].pins = 0;
 		coremap[idx + i].pid = 0;
 		coremap[idx + i].vaddr = 0;
 	}
 
+	if(num == 1 && cacheable && framecache_put(idx)){
+		return;
+	}
+
 	/* now, un-set the bitmaps */
-	spinlock_acquire(&coremap_spinlock);
+	coremap_spinlock_acquire();
 	for(int i = 0; i < num; i++){
 		bitmap_unmark(coremap_swappable, idx + i);
-		bitmap_unmark(coremap_free, idx + i);
+		if(bitmap_isset(coremap_free, idx + i)){
+			bitmap_unmark(coremap_free, idx + i);
+			buddy_free(idx + i, 1);
+			coremap_free_count++;
+		}
 	}
 	spinlock_release(&coremap_spinlock);
 
@@ -291,10 +877,15 @@ coremap_free_page(paddr_t paddr){
 	}
 }
 
+void 
+coremap_free_page(paddr_t paddr){
+	coremap_release_frames(paddr, true);
+}
+
 bool 
 coremap_lock_acquire(paddr_t paddr){
 	// now lay claim to the bitmap - keep a swap from sneaking up behind us
-	spinlock_acquire(&coremap_spinlock);
+	coremap_spinlock_acquire();
 	if(bitmap_isset(coremap_swappable, coremap_translate(paddr))){
 		spinlock_release(&coremap_spinlock);
 		return false;
@@ -307,7 +898,7 @@ coremap_lock_acquire(paddr_t paddr){
 void
 coremap_lock_release(paddr_t paddr){ 
 	// this shouldn't be done until there's a valid entry in the pagetable
-	spinlock_acquire(&coremap_spinlock);
+	coremap_spinlock_acquire();
 	bitmap_unmark(coremap_swappable, coremap_translate(paddr));
 	spinlock_release(&coremap_spinlock);
 }
@@ -323,3 +914,200 @@ coremap_mark_page_clean(paddr_t paddr){
 	int idx = coremap_translate(paddr);
 	coremap[idx].flags &= ~(COREMAP_DIRTY);
 }
+
+void
+coremap_mark_page_referenced(paddr_t paddr){
+	int idx = coremap_translate(paddr);
+	coremap_spinlock_acquire();
+	bool prefetched = coremap[idx].flags & COREMAP_PREFETCHED;
+	coremap[idx].flags |= COREMAP_REFERENCED;
+	coremap[idx].flags &= ~(COREMAP_PREFETCHED);
+	spinlock_release(&coremap_spinlock);
+
+	if(prefetched){
+		vmstat_inc(VMSTAT_PREFETCH_HITS);
+	}
+}
+
+int
+coremap_set_policy(int policy){
+	if(policy != COREMAP_POLICY_RANDOM && policy != COREMAP_POLICY_CLOCK
+			&& policy != COREMAP_POLICY_AGING){
+		return EINVAL;
+	}
+	coremap_spinlock_acquire();
+	coremap_policy = policy;
+	spinlock_release(&coremap_spinlock);
+	return 0;
+}
+
+int
+coremap_get_policy(void){
+	return coremap_policy;
+}
+
+/* Called with the coremap spinlock held, once a shared frame loses a reference or a pin. An unpinned
+ * frame with one mapper left passes to it; returns true if nobody maps the frame any more, in which
+ * case the caller frees it. */
+static
+bool
+coremap_settle_shared(unsigned int idx){
+	if(coremap[idx].pins > 0){
+		return false;
+	}
+	if(coremap[idx].refs == 0){
+		return true;
+	}
+	if(coremap[idx].refs == 1){
+		// the xor now names the one mapper left; hand it the frame and let it be evicted again
+		coremap[idx].flags &= ~(COREMAP_SHARED);
+		bitmap_unmark(coremap_swappable, idx);
+	}
+	return false;
+}
+
+bool
+coremap_share_page(paddr_t paddr, int pid){
+	int idx = coremap_translate(paddr);
+	coremap_spinlock_acquire();
+	if(coremap[idx].flags & COREMAP_SHARED){
+		coremap[idx].refs++;
+		coremap[idx].pid ^= pid;
+		spinlock_release(&coremap_spinlock);
+		return true;
+	}
+
+	// a marked page is mid-swap; the caller has to wait for it to settle
+	if(bitmap_isset(coremap_swappable, idx)){
+		spinlock_release(&coremap_spinlock);
+		return false;
+	}
+
+	// pin the frame, and make sure whoever is left holding it writes it back to their own swap block
+	bitmap_mark(coremap_swappable, idx);
+	coremap[idx].flags |= COREMAP_SHARED | COREMAP_DIRTY;
+	coremap[idx].refs++;
+	coremap[idx].pid ^= pid;
+	spinlock_release(&coremap_spinlock);
+	return true;
+}
+
+bool
+coremap_claim_page(paddr_t paddr, int pid){
+	int idx = coremap_translate(paddr);
+	coremap_spinlock_acquire();
+	if(!(coremap[idx].flags & COREMAP_SHARED)){
+		spinlock_release(&coremap_spinlock);
+		return true;
+	}
+
+	// still shared, or a copy-on-write fault in progress will settle the frame once it's done
+	if(coremap[idx].refs > 1 || coremap[idx].pins > 0){
+		spinlock_release(&coremap_spinlock);
+		return false;
+	}
+
+	// everyone else has let go; the page is ours and can be swapped again
+	coremap[idx].flags &= ~(COREMAP_SHARED);
+	coremap[idx].pid = pid;
+	bitmap_unmark(coremap_swappable, idx);
+	spinlock_release(&coremap_spinlock);
+	return true;
+}
+
+bool
+coremap_drop_shared(paddr_t paddr, int pid){
+	int idx = coremap_translate(paddr);
+	coremap_spinlock_acquire();
+	if(!(coremap[idx].flags & COREMAP_SHARED)){
+		spinlock_release(&coremap_spinlock);
+		return false;
+	}
+
+	KASSERT(coremap[idx].refs > 0);
+	coremap[idx].refs--;
+	coremap[idx].pid ^= pid;
+	bool last = coremap_settle_shared(idx);
+	spinlock_release(&coremap_spinlock);
+
+	if(last){
+		coremap_free_page(paddr);
+	}
+	return true;
+}
+
+bool
+coremap_pin_shared(paddr_t paddr){
+	int idx = coremap_translate(paddr);
+	coremap_spinlock_acquire();
+	bool shared = coremap[idx].flags & COREMAP_SHARED;
+	if(shared){
+		coremap[idx].pins++;
+	}
+	spinlock_release(&coremap_spinlock);
+	return shared;
+}
+
+void
+coremap_unpin_shared(paddr_t paddr){
+	int idx = coremap_translate(paddr);
+	coremap_spinlock_acquire();
+	KASSERT(coremap[idx].flags & COREMAP_SHARED);
+	KASSERT(coremap[idx].pins > 0);
+	coremap[idx].pins--;
+	bool last = coremap_settle_shared(idx);
+	spinlock_release(&coremap_spinlock);
+
+	if(last){
+		coremap_free_page(paddr);
+	}
+}
+
+bool
+coremap_claim_pinned(paddr_t paddr, int pid){
+	int idx = coremap_translate(paddr);
+	coremap_spinlock_acquire();
+	KASSERT(coremap[idx].flags & COREMAP_SHARED);
+	KASSERT(coremap[idx].pins > 0);
+	// another pin belongs to a fault that lost its mapping; that one settles the frame
+	if(coremap[idx].refs > 1 || coremap[idx].pins > 1){
+		spinlock_release(&coremap_spinlock);
+		return false;
+	}
+
+	// everyone else let go while we held the frame; keep it marked, as coremap_lock_acquire would
+	KASSERT(coremap[idx].refs == 1 && coremap[idx].pid == pid);
+	coremap[idx].pins = 0;
+	coremap[idx].flags &= ~(COREMAP_SHARED);
+	spinlock_release(&coremap_spinlock);
+	return true;
+}
+
+unsigned int
+coremap_resident_mappings(void){
+	unsigned int n = 0;
+	coremap_spinlock_acquire();
+	for(unsigned int i = 0; i < coremap_length; i++){
+		if(coremap[i].flags & COREMAP_INUSE){
+			n += coremap[i].refs;
+		}
+	}
+	spinlock_release(&coremap_spinlock);
+	return n;
+}
+
+void
+coremap_get_lockstats(unsigned int *acquires, unsigned int *contended){
+	spinlock_acquire(&coremap_spinlock);
+	*acquires = coremap_lock_acquires;
+	*contended = coremap_lock_contended;
+	spinlock_release(&coremap_spinlock);
+}
+
+void
+coremap_reset_lockstats(void){
+	spinlock_acquire(&coremap_spinlock);
+	coremap_lock_acquires = 0;
+	coremap_lock_contended = 0;
+	spinlock_release(&coremap_spinlock);
+}
@@ -4,6 +4,7 @@
 #include <kern/errno.h>
 #include <current.h>
 #include <proc.h>
+#include <thread.h>
 #include <spinlock.h>
 #include <synch.h>
 #include <coremap.h>
@@ -17,113 +18,225 @@ struct pagetable* pagetable_create(void)
   {
     return NULL;
   }
-  table->pagetable_lock = lock_create("pagetablelock");
+  table->pagetable_lock = rwlock_create("pagetablelock", RWLOCK_WRITER_PREF);
   if (table->pagetable_lock == NULL)
   {
     kfree(table);
     return NULL;
   }
 
-  table->valids = bitmap_create(1024);
-  if (table->valids == NULL)
+  table->leaves = kmalloc(PAGETABLE_DIR_SIZE * sizeof(struct pagetable_leaf *));
+  if(table->leaves == NULL)
   {
-    lock_destroy(table->pagetable_lock);
+    rwlock_destroy(table->pagetable_lock);
     kfree(table);
     return NULL;
   }
-
-  table->ptr = kmalloc(sizeof(struct pagetable_ptr));
-  if(table->ptr == NULL)
-  {
-    bitmap_destroy(table->valids);
-    lock_destroy(table->pagetable_lock);
-    kfree(table);
-    return 0;
-  }
+  memset(table->leaves, 0, PAGETABLE_DIR_SIZE * sizeof(struct pagetable_leaf *));
 
   return table;
 }
 
 static
-struct pagetable_subtable* pagetable_create_subtable(void)
+struct pagetable_leaf* pagetable_create_leaf(void)
 {
-  struct pagetable_subtable *subtable = kmalloc(sizeof(struct pagetable_subtable));
-  if(subtable == NULL)
+  struct pagetable_leaf *leaf = kmalloc(sizeof(struct pagetable_leaf));
+  if(leaf == NULL)
   {
     return NULL;
   }
 
-  subtable->valids = bitmap_create(1024);
-  if(subtable->valids == NULL)
+  leaf->entries = kmalloc(PAGETABLE_LEAF_SIZE * sizeof(struct pagetable_entry));
+  if(leaf->entries == NULL)
   {
-    kfree(subtable);
+    kfree(leaf);
     return NULL;
   }
+  memset(leaf->entries, 0, PAGETABLE_LEAF_SIZE * sizeof(struct pagetable_entry));
+  spinlock_init(&leaf->lock);
+
+  return leaf;
+}
+
+static
+void pagetable_destroy_leaf(struct pagetable_leaf *leaf)
+{
+  spinlock_cleanup(&leaf->lock);
+  kfree(leaf->entries);
+  kfree(leaf);
+}
+
+static
+unsigned pagetable_dir_index(vaddr_t vaddr)
+{
+  return vaddr >> (12 + PAGETABLE_LEAF_BITS);
+}
 
-  subtable->ptr = kmalloc(sizeof(struct pagetable_subptr));
-  if(subtable->ptr == NULL)
+static
+unsigned pagetable_leaf_index(vaddr_t vaddr)
+{
+  return (vaddr >> 12) & (PAGETABLE_LEAF_SIZE - 1);
+}
+
+static
+struct pagetable_leaf *pagetable_get_leaf(struct pagetable *table, vaddr_t vaddr)
+{
+  if(pagetable_dir_index(vaddr) >= PAGETABLE_DIR_SIZE)
   {
-    bitmap_destroy(subtable->valids);
-    kfree(subtable);
     return NULL;
   }
+  return table->leaves[pagetable_dir_index(vaddr)];
+}
 
-  return subtable;
+void pagetable_lock_entry(struct pagetable *table, vaddr_t vaddr)
+{
+  struct pagetable_leaf *leaf = pagetable_get_leaf(table, vaddr);
+  KASSERT(leaf != NULL);
+  spinlock_acquire(&leaf->lock);
 }
 
-void pagetable_swap_in(struct pagetable_entry *entry, vaddr_t vaddr, int pid)
+void pagetable_unlock_entry(struct pagetable *table, vaddr_t vaddr)
 {
-  paddr_t paddr = coremap_swap_page(entry->swap, (userptr_t) vaddr, pid);
-  entry->addr = paddr >> 12;
-  entry->flags |= PAGETABLE_INMEM;
-  entry->flags &= ~(PAGETABLE_DIRTY);
-  coremap_lock_release(entry->addr << 12);
+  struct pagetable_leaf *leaf = pagetable_get_leaf(table, vaddr);
+  KASSERT(leaf != NULL);
+  spinlock_release(&leaf->lock);
 }
 
-paddr_t pagetable_pull(struct pagetable* table, vaddr_t addr, uint8_t flags)
+// invalidates an entry; the leaf lock must be held
+static
+void pagetable_clear(struct pagetable_entry *entry)
 {
-  struct proc* cur = curproc;
-  paddr_t newpage = coremap_allocate_page(false, cur->pid, 1, (userptr_t) addr);
-  pagetable_add(table, addr, newpage, flags);
-  coremap_lock_release(newpage);
-  return newpage;
+  entry->addr = 0;
+  entry->flags = 0;
+  entry->swap = 0;
 }
 
-struct pagetable_entry *pagetable_lookup(struct pagetable* table, vaddr_t addr)
+unsigned pagetable_swap_in_cluster(struct pagetable *table, struct pagetable_entry *entry, vaddr_t vaddr, int pid, unsigned window)
 {
+  struct pagetable_entry *entries[SWAP_CLUSTER_MAX];
+  void *kvaddrs[SWAP_CLUSTER_MAX];
+  vaddr_t page = vaddr & PAGE_FRAME;
 
-  // we CAN'T kmalloc here, as we are potentially inside of a kmalloc call
+  if(window > SWAP_CLUSTER_MAX)
+  {
+    window = SWAP_CLUSTER_MAX;
+  }
 
-  int frame = addr >> 12;
-  int mainindex = frame >> 10;
+  // the faulting page itself is always read, evicting something if need be
+  paddr_t paddr = coremap_swap_frame((userptr_t) page, pid, false);
+  entries[0] = entry;
+  kvaddrs[0] = (void*) PADDR_TO_KVADDR(paddr);
+  unsigned n = 1;
 
-  int subindex = frame & 1023;
+  // a page that was evicted clean before it ever got a block is all zeroes
+  if(entry->swap == SWAP_NOBLOCK)
+  {
+    memset(kvaddrs[0], 0, PAGE_SIZE);
+    window = 0;
+    vmstat_inc(VMSTAT_ZERO_FILLS);
+  }
 
-  // we can get away without sleeplocking, because this particular vaddr-path won't change while we're looking up
-  // either it is valid or it isn't, but it can only be invalidated while it is not in memory and by the given process
+  // extend the read over following pages that are out on the following disk blocks, while free frames last
+  // nobody else brings this process's pages in, so a page that is out now stays out until we're done
+  while(n < window)
+  {
+    vaddr_t next = page + n * PAGE_SIZE;
+    if(next >= USERSTACK)
+    {
+      break;
+    }
+    struct pagetable_entry *neighbor = pagetable_lookup(table, next);
+    if(neighbor == NULL || (neighbor->flags & PAGETABLE_INMEM) || neighbor->swap != entry->swap + n)
+    {
+      break;
+    }
+    paddr = coremap_swap_frame((userptr_t) next, pid, true);
+    if(paddr == 0)
+    {
+      break;
+    }
+    entries[n] = neighbor;
+    kvaddrs[n] = (void*) PADDR_TO_KVADDR(paddr);
+    n++;
+  }
 
-  if (!bitmap_isset(table->valids, mainindex))
+  if(entry->swap != SWAP_NOBLOCK)
   {
-    return NULL;
+    swap_pages_in(kvaddrs, entry->swap, n);
+  }
+  if(n > 1)
+  {
+    vmstat_add(VMSTAT_PREFETCHED, n - 1);
   }
 
-  struct pagetable_subtable *subtable = table->ptr->entries[mainindex];
-  if(!bitmap_isset(subtable->valids, subindex))
+  for(unsigned i = 0; i < n; i++)
   {
-    return NULL;
+    pagetable_lock_entry(table, page + i * PAGE_SIZE);
+    entries[i]->addr = KVADDR_TO_PADDR((vaddr_t) kvaddrs[i]) >> 12;
+    entries[i]->flags |= PAGETABLE_INMEM;
+    entries[i]->flags &= ~(PAGETABLE_DIRTY);
+    pagetable_unlock_entry(table, page + i * PAGE_SIZE);
+    coremap_lock_release(entries[i]->addr << 12);
   }
 
-  struct pagetable_entry* entry = subtable->ptr->entries[subindex];
-  if (entry == NULL)
+  return n;
+}
+
+/* Swap blocks are handed out next to the previous virtual page's block where possible,
+ * so that sequential runs of pages can be read in with one request */
+static
+unsigned pagetable_swap_hint(struct pagetable *table, vaddr_t vaddr)
+{
+  if(vaddr < PAGE_SIZE)
+  {
+    return 0;
+  }
+  struct pagetable_entry *prev = pagetable_lookup(table, vaddr - PAGE_SIZE);
+  if(prev == NULL || prev->swap == SWAP_NOBLOCK)
+  {
+    return 0;
+  }
+  return prev->swap + 1;
+}
+
+int pagetable_assign_swap(struct pagetable *table, struct pagetable_entry *entry, vaddr_t vaddr)
+{
+  if(entry->swap != SWAP_NOBLOCK)
+  {
+    return 0;
+  }
+  return swap_allocate_near(pagetable_swap_hint(table, vaddr), &entry->swap);
+}
+
+paddr_t pagetable_pull(struct pagetable* table, vaddr_t addr, uint8_t flags)
+{
+  struct proc* cur = curproc;
+  paddr_t newpage = coremap_allocate_page(false, cur->pid, 1, (userptr_t) addr);
+  if(!pagetable_add(table, addr, newpage, flags))
+  {
+    coremap_free_page(newpage);
+    return 0;
+  }
+  coremap_lock_release(newpage);
+  return newpage;
+}
+
+struct pagetable_entry *pagetable_lookup(struct pagetable* table, vaddr_t addr)
+{
+  // we CAN'T kmalloc here, as we are potentially inside of a kmalloc call
+
+  // we can get away without locking, because leaves are never freed before the table is, and
+  // an entry only becomes invalid while it is not in memory and at the hands of its own process
+  struct pagetable_leaf *leaf = pagetable_get_leaf(table, addr);
+  if(leaf == NULL)
   {
     return NULL;
   }
 
-  // clear invalid entry
-  if(!entry->flags & PAGETABLE_VALID){
-    kfree(entry);
-    bitmap_unmark(subtable->valids, subindex);
-    entry = NULL;
+  struct pagetable_entry *entry = &leaf->entries[pagetable_leaf_index(addr)];
+  if(!(entry->flags & PAGETABLE_VALID))
+  {
+    return NULL;
   }
 
   return entry;
@@ -133,117 +246,105 @@ bool pagetable_add(struct pagetable* table, vaddr_t vaddr, paddr_t paddr, uint8_
 {
   // anything that could call kmalloc can't hold the pagetable lock, ever
 
-  vaddr_t frame = vaddr >> 12;
-  int mainindex = frame >> 10;
-
-  int subindex = frame & 1023;
+  unsigned dirindex = pagetable_dir_index(vaddr);
+  if(dirindex >= PAGETABLE_DIR_SIZE)
+  {
+    return false;
+  }
 
-  lock_acquire(table->pagetable_lock);
-  struct pagetable_subtable *subtable = table->ptr->entries[mainindex];
-  if (!bitmap_isset(table->valids, mainindex))
+  rwlock_acquire_read(table->pagetable_lock);
+  struct pagetable_leaf *leaf = table->leaves[dirindex];
+  if (leaf == NULL)
   {
     // release lock to use kmalloc
-    lock_release(table->pagetable_lock);
-    subtable = pagetable_create_subtable();
-    lock_acquire(table->pagetable_lock);
-    if(subtable == NULL)
+    rwlock_release_read(table->pagetable_lock);
+    leaf = pagetable_create_leaf();
+    if(leaf == NULL)
     {
        //ENOMEM
        return false;
     }
-    if(!bitmap_isset(table->valids, mainindex))
+    // installing a leaf changes the tree, so it needs the lock to ourselves
+    rwlock_acquire_write(table->pagetable_lock);
+    if(table->leaves[dirindex] == NULL)
     {
-      bitmap_mark(table->valids, mainindex);
-      table->ptr->entries[mainindex] = subtable;
+      table->leaves[dirindex] = leaf;
     }
     else 
-    { // the subtable was allocated while we had released the lock
-      kfree(subtable->valids);
-      kfree(subtable->ptr);
-      kfree(subtable);
+    { // the leaf was allocated while we had released the lock
+      pagetable_destroy_leaf(leaf);
+      leaf = table->leaves[dirindex];
     }
+    rwlock_release_write(table->pagetable_lock);
+    rwlock_acquire_read(table->pagetable_lock);
   } 
 
-  if (!bitmap_isset(subtable->valids, subindex))
+  struct pagetable_entry *entry = &leaf->entries[pagetable_leaf_index(vaddr)];
+  if(entry->flags & PAGETABLE_VALID)
   {
-    // since kmalloc can allocate pages, we might deadlock
-    lock_release(table->pagetable_lock);
-    struct pagetable_entry *entry = kmalloc(sizeof(struct pagetable_entry));
-    entry->addr = paddr >> 12;
-    int err = swap_allocate(&entry->swap);
-    if(err){
-	// TODO: out of swap space
-        return false;
-    }
-    entry->flags = flags | PAGETABLE_VALID | PAGETABLE_INMEM;
-    spinlock_init(&entry->lock);
-
-    lock_acquire(table->pagetable_lock);
-    bitmap_mark(subtable->valids, subindex);
-    subtable->ptr->entries[subindex] = entry;
-    lock_release(table->pagetable_lock);
-
-    return true;
+    swap_free(entry->swap);
+  }
+  // the swap block itself is only assigned if the page is ever swapped out
+  else if(swap_reserve(1))
+  {
+    rwlock_release_read(table->pagetable_lock);
+    return false;
   }
 
-  struct pagetable_entry *entry = subtable->ptr->entries[subindex];
+  spinlock_acquire(&leaf->lock);
   entry->addr = paddr >> 12;
-  int err = swap_allocate(&entry->swap);
-  if(err){
-	// TODO: out of swap space
-	return false;
-  }
+  entry->swap = SWAP_NOBLOCK;
   entry->flags = flags | PAGETABLE_VALID | PAGETABLE_INMEM;
-  lock_release(table->pagetable_lock);
+  spinlock_release(&leaf->lock);
+  rwlock_release_read(table->pagetable_lock);
 
   return true;
 }
 
-bool pagetable_remove(struct pagetable* table, vaddr_t vaddr)
+bool pagetable_remove(struct pagetable* table, vaddr_t vaddr, int pid)
 {
-  int frame = vaddr >> 12;
-  int mainindex = frame >> 10;
-
-  int subindex = frame & 1023;
-
-  lock_acquire(table->pagetable_lock);
-  if (!bitmap_isset(table->valids, mainindex))
+  rwlock_acquire_read(table->pagetable_lock);
+  struct pagetable_leaf *leaf = pagetable_get_leaf(table, vaddr);
+  if (leaf == NULL)
   {
-    lock_release(table->pagetable_lock);
+    rwlock_release_read(table->pagetable_lock);
     return false;
   }
 
-  struct pagetable_subtable* subtable = table->ptr->entries[mainindex];
-  if (!bitmap_isset(subtable->valids, subindex))
+  struct pagetable_entry *entry = &leaf->entries[pagetable_leaf_index(vaddr)];
+  if (!(entry->flags & PAGETABLE_VALID))
   {
-    lock_release(table->pagetable_lock);
+    rwlock_release_read(table->pagetable_lock);
     return false;
   }
 
-  struct pagetable_entry *entry = subtable->ptr->entries[subindex];
-
   // remove page from coremap and disk
-  spinlock_acquire(&entry->lock);
-  lock_release(table->pagetable_lock); // cannot touch coremap while holding ptbl lock
-
-  if(entry->flags | PAGETABLE_INMEM){
-    bool inmem = coremap_lock_acquire(entry->addr << 12);
+  spinlock_acquire(&leaf->lock);
+  rwlock_release_read(table->pagetable_lock); // cannot touch coremap while holding ptbl lock
+
+  paddr_t paddr = entry->addr << 12;
+  unsigned swap = entry->swap;
+  if((entry->flags & PAGETABLE_INMEM) && coremap_drop_shared(paddr, pid)){
+    // another address space still maps the frame; only our swap block goes
+    pagetable_clear(entry);
+    spinlock_release(&leaf->lock);
+    swap_discard(swap);
+  } else if(entry->flags & PAGETABLE_INMEM){
+    bool inmem = coremap_lock_acquire(paddr);
     if(inmem){
-      spinlock_release(&entry->lock);
-      coremap_free_page(entry->addr << 12);
-      swap_free(entry->swap);
-      bitmap_unmark(subtable->valids, subindex);
-      kfree(entry);
+      pagetable_clear(entry);
+      spinlock_release(&leaf->lock);
+      coremap_free_page(paddr);
+      swap_discard(swap);
     }else{
       // the page is in the process of being swapped out by another process (can't free directly)
       entry->flags |= PAGETABLE_REQUEST_FREE;
-      spinlock_release(&entry->lock);
+      spinlock_release(&leaf->lock);
     }
   } else {
-    spinlock_release(&entry->lock);
-    swap_free(entry->swap);
-    bitmap_unmark(subtable->valids, subindex);
-    kfree(entry);
+    pagetable_clear(entry);
+    spinlock_release(&leaf->lock);
+    swap_discard(swap);
   }
 
   return true;
@@ -253,171 +354,167 @@ bool pagetable_copy(struct pagetable *old, int oldpid, struct pagetable *copy, i
 {
   (void) oldpid;
 
-  lock_acquire(copy->pagetable_lock);
-  lock_acquire(old->pagetable_lock);
+  // only the forking thread can see the copy yet; the old table is just walked
+  rwlock_acquire_write(copy->pagetable_lock);
+  rwlock_acquire_read(old->pagetable_lock);
 
-  for(int i = 0; i < 1024; i++)
+  for(int i = 0; i < PAGETABLE_DIR_SIZE; i++)
   {
     // we have to be inside the lock - so no kmalloc
 
-    if(!bitmap_isset(old->valids, i))
+    struct pagetable_leaf *leaf = old->leaves[i];
+    if(leaf == NULL)
     {
       continue;
     }
 
-    struct pagetable_subtable *subtable = old->ptr->entries[i];
-
-    lock_release(copy->pagetable_lock);
-    lock_release(old->pagetable_lock);
-    struct pagetable_subtable *copy_subtable = pagetable_create_subtable();
-    if(copy_subtable == NULL){
+    rwlock_release_write(copy->pagetable_lock);
+    rwlock_release_read(old->pagetable_lock);
+    struct pagetable_leaf *copy_leaf = pagetable_create_leaf();
+    if(copy_leaf == NULL){
       return false;
     }
-    lock_acquire(old->pagetable_lock);
-    lock_acquire(copy->pagetable_lock);
+    rwlock_acquire_write(copy->pagetable_lock);
+    rwlock_acquire_read(old->pagetable_lock);
 
-    bitmap_mark(copy->valids, i);
-    copy->ptr->entries[i] = copy_subtable;
+    copy->leaves[i] = copy_leaf;
 
-    for(int j = 0; j < 1024; j++)
+    for(int j = 0; j < PAGETABLE_LEAF_SIZE; j++)
     {
-      struct pagetable_entry* entry = subtable->ptr->entries[j];
+      struct pagetable_entry* entry = &leaf->entries[j];
 
-      if(bitmap_isset(subtable->valids, j) && (entry->flags & PAGETABLE_VALID))
+      if(entry->flags & PAGETABLE_VALID)
       {
-        lock_release(copy->pagetable_lock);
-        lock_release(old->pagetable_lock);
-        struct pagetable_entry *copy_entry = kmalloc(sizeof(struct pagetable_entry));
-        vaddr_t vaddr = (i << 22) | (j << 12);
-
-	// protect against race condition with the coremap bringing in a new pag
-	// TODO: figure out how to do this best WITHOUT holding spinlocks
-	spinlock_acquire(&entry->lock);
-        if(entry->flags & PAGETABLE_DIRTY)
-        {
-          spinlock_release(&entry->lock);
-          // force a write to disk
-          swap_page_out((void*) PADDR_TO_KVADDR(entry->addr << 12), entry->swap);
-        }
-        else
+        rwlock_release_write(copy->pagetable_lock);
+        rwlock_release_read(old->pagetable_lock);
+        // fail the fork up front rather than leave the child unable to swap
+        if(swap_reserve(1))
         {
-          spinlock_release(&entry->lock);
+          return false;
         }
-        
-        // copy by bringing the old page's disk into the copy's memory segment
-        copy_entry->addr = coremap_allocate_page(false, copypid, 1, (userptr_t) vaddr) >> 12;
-        swap_page_in((void*) PADDR_TO_KVADDR(copy_entry->addr << 12), entry->swap);
-
-	// push the copy out to it's disk segment
-        swap_allocate(&copy_entry->swap);
-        swap_page_out((void*) PADDR_TO_KVADDR(copy_entry->addr << 12), copy_entry->swap);
-        copy_entry->flags = PAGETABLE_VALID | PAGETABLE_INMEM;
-        
-        if(entry->flags | PAGETABLE_READABLE)
+        vaddr_t vaddr = (i << (12 + PAGETABLE_LEAF_BITS)) | (j << 12);
+
+        struct pagetable_entry copy_entry;
+        copy_entry.swap = SWAP_NOBLOCK;
+        copy_entry.flags = PAGETABLE_VALID | PAGETABLE_INMEM | PAGETABLE_DIRTY |
+          (entry->flags & (PAGETABLE_READABLE | PAGETABLE_WRITEABLE | PAGETABLE_EXECUTABLE));
+
+        // resident pages are shared copy-on-write; the first write in either process breaks the sharing
+        bool shared = false;
+        spinlock_acquire(&leaf->lock);
+        while(entry->flags & PAGETABLE_INMEM)
         {
-          copy_entry->flags |= PAGETABLE_READABLE;
+          if(coremap_share_page(entry->addr << 12, copypid))
+          {
+            // the frame no longer matches this entry's swap block once the other side writes
+            entry->flags |= PAGETABLE_DIRTY;
+            copy_entry.addr = entry->addr;
+            shared = true;
+            break;
+          }
+          // the page is on its way out to disk; wait for the eviction to finish
+          spinlock_release(&leaf->lock);
+          thread_yield();
+          spinlock_acquire(&leaf->lock);
         }
-        if(entry->flags | PAGETABLE_WRITEABLE)
+        spinlock_release(&leaf->lock);
+
+        if(!shared)
         {
-          copy_entry->flags |= PAGETABLE_WRITEABLE;
+          // swapped-out pages are copied straight from the old page's disk block into the copy's memory
+          copy_entry.addr = coremap_allocate_page(false, copypid, 1, (userptr_t) vaddr) >> 12;
+          if(entry->swap != SWAP_NOBLOCK)
+          {
+            swap_page_in((void*) PADDR_TO_KVADDR(copy_entry.addr << 12), entry->swap);
+          }
+          coremap_mark_page_dirty(copy_entry.addr << 12);
         }
-        if(entry->flags | PAGETABLE_EXECUTABLE)
+
+        rwlock_acquire_write(copy->pagetable_lock);
+        rwlock_acquire_read(old->pagetable_lock);
+        spinlock_acquire(&copy_leaf->lock);
+        copy_leaf->entries[j] = copy_entry;
+        spinlock_release(&copy_leaf->lock);
+        if(!shared)
         {
-          copy_entry->flags |= PAGETABLE_EXECUTABLE;
+          coremap_lock_release(copy_entry.addr << 12);
         }
-        spinlock_init(&copy_entry->lock);
-
-        lock_acquire(copy->pagetable_lock);
-        lock_acquire(old->pagetable_lock);
-        bitmap_mark(copy_subtable->valids, j);
-        copy_subtable->ptr->entries[j] = copy_entry;
-        coremap_lock_release(copy_entry->addr << 12);
       }
     }
   }
 
-  lock_release(old->pagetable_lock);
-  lock_release(copy->pagetable_lock);
+  rwlock_release_read(old->pagetable_lock);
+  rwlock_release_write(copy->pagetable_lock);
   return true;
 }
 
-int pagetable_free_all(struct pagetable* table)
+int pagetable_free_all(struct pagetable* table, int pid)
 {
   int ref = 0;
-  lock_acquire(table->pagetable_lock);
-  for(int i = 0; i < 1024; i++)
+  rwlock_acquire_write(table->pagetable_lock);
+  for(int i = 0; i < PAGETABLE_DIR_SIZE; i++)
   {
-    if(!bitmap_isset(table->valids, i))
+    struct pagetable_leaf *leaf = table->leaves[i];
+    if(leaf == NULL)
     {
       continue;
     }
 
-    struct pagetable_subtable* subtable = table->ptr->entries[i];
-    for(int j = 0; j < 1024; j++)
+    for(int j = 0; j < PAGETABLE_LEAF_SIZE; j++)
     {
-      if(!bitmap_isset(subtable->valids, j))
+      struct pagetable_entry* entry = &leaf->entries[j];
+
+      if(!(entry->flags & PAGETABLE_VALID))
       {
         continue;
       }
-      struct pagetable_entry* entry = subtable->ptr->entries[j];
 
-      if(!entry->flags & PAGETABLE_VALID)
+      spinlock_acquire(&leaf->lock);
+      paddr_t paddr = entry->addr << 12;
+      unsigned swap = entry->swap;
+      if((entry->flags & PAGETABLE_INMEM) && coremap_drop_shared(paddr, pid))
       {
-        continue;
+        pagetable_clear(entry);
+        spinlock_release(&leaf->lock);
+        swap_discard(swap);
       }
-
-      spinlock_acquire(&entry->lock);
-      if(entry->flags & PAGETABLE_INMEM)
+      else if(entry->flags & PAGETABLE_INMEM)
       {
-        if(coremap_lock_acquire(entry->addr << 12))
+        if(coremap_lock_acquire(paddr))
         {
-          spinlock_release(&entry->lock);
-          coremap_free_page(entry->addr << 12);
-          swap_free(entry->swap);
-          entry->flags &= ~(PAGETABLE_VALID);
+          pagetable_clear(entry);
+          spinlock_release(&leaf->lock);
+          coremap_free_page(paddr);
+          swap_discard(swap);
         } else {
           entry->flags |= PAGETABLE_REQUEST_FREE | PAGETABLE_REQUEST_DESTROY;
           ref++;
-          spinlock_release(&entry->lock);
+          spinlock_release(&leaf->lock);
         }
       } else {
-        spinlock_release(&entry->lock);
-	swap_free(entry->swap);
-        entry->flags &= ~(PAGETABLE_VALID);
+        pagetable_clear(entry);
+        spinlock_release(&leaf->lock);
+        swap_discard(swap);
       }
     }
   }
-  lock_release(table->pagetable_lock);
+  rwlock_release_write(table->pagetable_lock);
   return ref;
 }
 
 int pagetable_destroy(struct pagetable* table)
 {
-  lock_acquire(table->pagetable_lock);
-  for(int i = 0; i < 1024; i++)
+  rwlock_acquire_write(table->pagetable_lock);
+  for(int i = 0; i < PAGETABLE_DIR_SIZE; i++)
   {
-    if(!bitmap_isset(table->valids, i))
-    {
-       continue;
-    }
-    struct pagetable_subtable* subtable = table->ptr->entries[i];
-    for(int j = 0; j < 1024; j++)
+    if(table->leaves[i] != NULL)
     {
-      if(!bitmap_isset(subtable->valids, j))
-      {
-        continue;
-      }
-      struct pagetable_entry* entry = subtable->ptr->entries[j];
-
-      kfree(entry);
+      pagetable_destroy_leaf(table->leaves[i]);
     }
-    kfree(subtable->ptr);
-    kfree(subtable->valids);
-    kfree(subtable);
   }
-  kfree(table->ptr);
-  lock_release(table->pagetable_lock);
-  lock_destroy(table->pagetable_lock);
+  kfree(table->leaves);
+  rwlock_release_write(table->pagetable_lock);
+  rwlock_destroy(table->pagetable_lock);
   kfree(table);
   table = NULL;
   return 0;
@@ -7,11 +7,15 @@
 #include <uio.h>
 #include <vnode.h>
 #include <vfs.h>
+#include <vm.h>
 #include <swap.h>
 
 // lock to protect the bitmap
 struct spinlock swap_spinlock;
 struct bitmap *swap_freelist;
+unsigned int swap_npages;
+unsigned int swap_nreserved;
+unsigned int swap_nused;
 
 struct vnode *swap_space;
 size_t page_size; 
@@ -34,12 +38,18 @@ swap_bootstrap(size_t page_size_param){
 	VOP_STAT(swap_space, &swap_stats);
 	unsigned int num_pgs = swap_stats.st_size / page_size; 
 	swap_freelist = bitmap_create(num_pgs);
+	swap_npages = num_pgs;
+	swap_nreserved = 0;
+	swap_nused = 0;
 }
 
 int
 swap_allocate(unsigned int *block){
 	spinlock_acquire(&swap_spinlock);
 	int err = bitmap_alloc(swap_freelist, block);
+	if(!err){
+		swap_nused++;
+	}
 	spinlock_release(&swap_spinlock);
 
 	if(err){
@@ -51,56 +61,134 @@ swap_allocate(unsigned int *block){
 	return 0;
 }
 
+int
+swap_allocate_near(unsigned int hint, unsigned int *block){
+	spinlock_acquire(&swap_spinlock);
+	int err = 1;
+	if(hint < swap_npages){
+		if(!bitmap_isset(swap_freelist, hint)){
+			bitmap_mark(swap_freelist, hint);
+			*block = hint;
+			err = 0;
+		} else {
+			err = bitmap_alloc_after(swap_freelist, hint, block);
+		}
+	}
+	if(err){
+		// nothing free after the hint; take anything
+		err = bitmap_alloc(swap_freelist, block);
+	}
+	if(!err){
+		swap_nused++;
+	}
+	spinlock_release(&swap_spinlock);
+
+	if(err){
+		return ENOSPC;
+	}
+
+	return 0;
+}
+
 void
 swap_free(unsigned int block){
-	// TODO: verify that the index is within the bounds of the space
+	if(block == SWAP_NOBLOCK){
+		return;
+	}
+	KASSERT(block < swap_npages);
 
 	spinlock_acquire(&swap_spinlock);
 	
 	bitmap_unmark(swap_freelist, block);
+	swap_nused--;
 
 	spinlock_release(&swap_spinlock);
 }
 
+int
+swap_reserve(unsigned int npages){
+	spinlock_acquire(&swap_spinlock);
+	if(npages > swap_npages - swap_nreserved){
+		spinlock_release(&swap_spinlock);
+		return ENOMEM;
+	}
+	swap_nreserved += npages;
+	spinlock_release(&swap_spinlock);
+	return 0;
+}
+
 void
-swap_page_in(void* kvaddr, unsigned int block){
+swap_unreserve(unsigned int npages){
+	spinlock_acquire(&swap_spinlock);
+	KASSERT(swap_nreserved >= npages);
+	swap_nreserved -= npages;
+	spinlock_release(&swap_spinlock);
+}
 
-	// place data  on the stack - not safe to kmalloc
-	struct iovec iov_page;
-	iov_page.iov_kbase = kvaddr;
-	iov_page.iov_len = page_size;
+void
+swap_discard(unsigned int block){
+	swap_free(block);
+	swap_unreserve(1);
+}
 
-	struct uio swap_uio;
-	// set uio with the block index and pointer
-	swap_uio.uio_iov = &iov_page;
-	swap_uio.uio_iovcnt = 1;
-	swap_uio.uio_offset = block * page_size;
-	swap_uio.uio_resid = page_size;
-	// pretending that everything is kernelspace means not dealing w/ userspace vaddrs
-	swap_uio.uio_segflg = UIO_SYSSPACE; 
-	swap_uio.uio_rw = UIO_READ;
-	swap_uio.uio_space = NULL;
+void
+swap_getstats(unsigned int *total, unsigned int *reserved, unsigned int *used){
+	spinlock_acquire(&swap_spinlock);
+	*total = swap_npages;
+	*reserved = swap_nreserved;
+	*used = swap_nused;
+	spinlock_release(&swap_spinlock);
+}
 
-	VOP_READ(swap_space, &swap_uio);
+void
+swap_page_in(void* kvaddr, unsigned int block){
+	swap_pages_in(&kvaddr, block, 1);
 }
 
 void
 swap_page_out(void* kvaddr, unsigned int block){
-	// leave data on the stack, not safe to kmalloc
-	struct iovec iov_page;
-	iov_page.iov_kbase = kvaddr;
-	iov_page.iov_len = page_size;
+	swap_pages_out(&kvaddr, block, 1);
+}
+
+// shared by reads and writes; all data stays on the stack, since it's not safe to kmalloc
+static
+void
+swap_io(void **kvaddrs, unsigned int block, unsigned int npages, enum uio_rw rw){
+	KASSERT(npages > 0 && npages <= SWAP_CLUSTER_MAX);
+
+	// one iovec per page
+	struct iovec iov_pages[SWAP_CLUSTER_MAX];
+	for(unsigned int i = 0; i < npages; i++){
+		iov_pages[i].iov_kbase = kvaddrs[i];
+		iov_pages[i].iov_len = page_size;
+	}
 
 	struct uio swap_uio;
-	// set uio with the block index and pointer
-	swap_uio.uio_iov = &iov_page;
-	swap_uio.uio_iovcnt = 1;
+	// set uio with the block index and pointers
+	swap_uio.uio_iov = iov_pages;
+	swap_uio.uio_iovcnt = npages;
 	swap_uio.uio_offset = block * page_size;
-	swap_uio.uio_resid = page_size;
+	swap_uio.uio_resid = npages * page_size;
 	// pretending that everything is kernelspace means not dealing w/ userspace vaddrs
 	swap_uio.uio_segflg = UIO_SYSSPACE; 
-	swap_uio.uio_rw = UIO_WRITE;
+	swap_uio.uio_rw = rw;
 	swap_uio.uio_space = NULL;
-	
-	VOP_WRITE(swap_space, &swap_uio);
+
+	if(rw == UIO_READ){
+		vmstat_add(VMSTAT_SWAP_READS, npages);
+		VOP_READ(swap_space, &swap_uio);
+	} else {
+		vmstat_add(VMSTAT_SWAP_WRITES, npages);
+		VOP_WRITE(swap_space, &swap_uio);
+	}
+}
+
+void
+swap_pages_in(void **kvaddrs, unsigned int block, unsigned int npages){
+	swap_io(kvaddrs, block, npages, UIO_READ);
+}
+
+void
+swap_pages_out(void **kvaddrs, unsigned int block, unsigned int npages){
+	swap_io(kvaddrs, block, npages, UIO_WRITE);
 }
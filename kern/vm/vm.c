@@ -1,4 +1,5 @@
 #include <types.h>
+#include <lib.h>
 #include <current.h>
 #include <spinlock.h>
 #include <synch.h>
@@ -8,6 +9,8 @@
 #include <vm.h>
 #include <coremap.h>
 #include <pagetable.h>
+#include <swap.h>
+#include <kern/errno.h>
 
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages){
@@ -29,4 +32,111 @@ void free_kpages(vaddr_t addr){
 	coremap_free_page(paddr);
 }
 
+static struct spinlock vmstat_lock = SPINLOCK_INITIALIZER;
+static unsigned vmstat_counts[VMSTAT_NUM];
 
+static const char *vmstat_names[VMSTAT_NUM] = {
+	"faults",
+	"tlb refills",
+	"zero fills",
+	"swap ins",
+	"evictions",
+	"reference clears",
+	"swap reads",
+	"swap writes",
+	"cow copies",
+	"direct evictions",
+	"pageout batches",
+	"prefetched",
+	"prefetch hits",
+	"prefetch wasted",
+	"frame cache refills",
+	"frame cache drains",
+	"tlb flushes",
+	"asid rollovers",
+	"shootdown ipis",
+	"shootdown pages",
+	"exec page-ins",
+};
+
+static const char *vmstat_policies[] = {
+	"random",
+	"clock",
+	"aging",
+};
+
+void vmstat_inc(int stat){
+	vmstat_add(stat, 1);
+}
+
+void vmstat_add(int stat, unsigned n){
+	KASSERT(stat >= 0 && stat < VMSTAT_NUM);
+	spinlock_acquire(&vmstat_lock);
+	vmstat_counts[stat] += n;
+	spinlock_release(&vmstat_lock);
+}
+
+void vmstat_reset(void){
+	spinlock_acquire(&vmstat_lock);
+	for(int i = 0; i < VMSTAT_NUM; i++){
+		vmstat_counts[i] = 0;
+	}
+	spinlock_release(&vmstat_lock);
+	coremap_reset_lockstats();
+}
+
+void vmstat_print(void){
+	unsigned counts[VMSTAT_NUM];
+
+	// copy out first; kprintf can sleep
+	spinlock_acquire(&vmstat_lock);
+	for(int i = 0; i < VMSTAT_NUM; i++){
+		counts[i] = vmstat_counts[i];
+	}
+	spinlock_release(&vmstat_lock);
+
+	kprintf("replacement policy: %s\n", vmstat_policies[coremap_get_policy()]);
+	for(int i = 0; i < VMSTAT_NUM; i++){
+		kprintf("%20s: %u\n", vmstat_names[i], counts[i]);
+	}
+
+	// a fault that found its page resident (or needed no disk read) is a hit
+	if(counts[VMSTAT_FAULTS] > 0){
+		unsigned hits = counts[VMSTAT_FAULTS] - counts[VMSTAT_SWAP_INS] - counts[VMSTAT_EXEC_PAGEINS];
+		kprintf("%20s: %u%%\n", "hit rate", hits * 100 / counts[VMSTAT_FAULTS]);
+	}
+	if(counts[VMSTAT_PREFETCHED] > 0){
+		kprintf("%20s: %u%%\n", "prefetch hit rate",
+			counts[VMSTAT_PREFETCH_HITS] * 100 / counts[VMSTAT_PREFETCHED]);
+	}
+	kprintf("%20s: %u\n", "read-ahead window", vm_get_readahead());
+
+	unsigned acquires, contended;
+	coremap_get_lockstats(&acquires, &contended);
+	kprintf("%20s: %u\n", "coremap lock takes", acquires);
+	kprintf("%20s: %u\n", "coremap lock waits", contended);
+
+	// every valid user page holds a swap reservation, so the ones not resident are out on disk
+	unsigned total, reserved, used;
+	swap_getstats(&total, &reserved, &used);
+	unsigned resident = coremap_resident_mappings();
+	kprintf("%20s: %u\n", "swap blocks", total);
+	kprintf("%20s: %u\n", "swap committed", reserved);
+	kprintf("%20s: %u\n", "swap in use", used);
+	kprintf("%20s: %u\n", "resident pages", resident);
+	kprintf("%20s: %u\n", "swapped pages", reserved > resident ? reserved - resident : 0);
+}
+
+static unsigned vm_readahead = VM_READAHEAD_DEFAULT;
+
+unsigned vm_get_readahead(void){
+	return vm_readahead;
+}
+
+int vm_set_readahead(unsigned window){
+	if(window < 1 || window > SWAP_CLUSTER_MAX){
+		return EINVAL;
+	}
+	vm_readahead = window;
+	return 0;
+}
@@ -55,6 +55,8 @@
  *
  *     stat:     sys/stat.h
  *     fstat:    sys/stat.h
+ *     readv:    sys/uio.h
+ *     writev:   sys/uio.h
  *     lstat:    sys/stat.h
  *     mkdir:    sys/stat.h
  *
@@ -148,6 +150,10 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+/* readv - see sys/uio.h */
+/* writev - see sys/uio.h */
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -72,6 +72,7 @@ extern const char *hostcompat_progname;
 static bool dofiles, dodirs;
 static bool doindirect;
 static bool recurse;
+static bool dumphashed;		/* set by dumpdir for hashed directories */
 
 ////////////////////////////////////////////////////////////
 // printouts
@@ -314,12 +315,25 @@ dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 	printf("    [block %u]\n", diskblock);
 	for (i=0; i<nsds; i++) {
 		uint32_t ino = SWAP32(sds[i].sfd_ino);
-		if (ino==SFS_NOINO) {
-			printf("        [free entry]\n");
+		sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
+		if (dumphashed) {
+			/* skip never-used slots; show the slot number */
+			if (ino==SFS_NOINO && sds[i].sfd_name[0] == 0) {
+				continue;
+			}
+			printf("        @%-4u ", fileblock * nsds + i);
+		}
+		else {
+			printf("        ");
+		}
+		if (ino==SFS_NOINO && dumphashed) {
+			printf("[deleted %s]\n", sds[i].sfd_name);
+		}
+		else if (ino==SFS_NOINO) {
+			printf("[free entry]\n");
 		}
 		else {
-			sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
-			printf("        %u %s\n", ino, sds[i].sfd_name);
+			printf("%u %s\n", ino, sds[i].sfd_name);
 		}
 	}
 }
@@ -334,8 +348,17 @@ dumpdir(uint32_t ino, const struct sfs_dinode *sfi)
 	if (SWAP32(sfi->sfi_size) % sizeof(struct sfs_direntry) != 0) {
 		warnx("Warning: dir size is not a multiple of dir entry size");
 	}
-	printf("Directory contents for inode %u: %d entries\n", ino, nentries);
+	dumphashed = (SWAP32(sfi->sfi_flags) & SFS_INODEF_HASHDIR) != 0;
+	if (dumphashed) {
+		printf("Directory contents for inode %u: hashed, %d slots\n",
+		       ino, nentries);
+	}
+	else {
+		printf("Directory contents for inode %u: %d entries\n",
+		       ino, nentries);
+	}
 	traverse(sfi, dumpdirblock);
+	dumphashed = false;
 }
 
 static
@@ -449,6 +472,9 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
 	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
+	dumpvalf("Flags", "0x%x%s", SWAP32(sfi.sfi_flags),
+		 (SWAP32(sfi.sfi_flags) & SFS_INODEF_HASHDIR) ?
+		 " (hashed directory)" : "");
 	printf("\n");
 
         printf("    Direct blocks:\n");
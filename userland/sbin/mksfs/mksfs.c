@@ -165,11 +165,66 @@ writefreemap(uint32_t fsblocks)
 }
 
 /*
- * Write out the root directory inode.
+ * Find a free block, mark it allocated, and zero it on disk.
+ */
+static
+uint32_t
+newblock(uint32_t fsblocks)
+{
+	char zeros[SFS_BLOCKSIZE];
+	uint32_t mapbyte, block;
+	unsigned char mask;
+
+	for (block=0; block<fsblocks; block++) {
+		mapbyte = block/CHAR_BIT;
+		mask = (1<<(block % CHAR_BIT));
+		if ((freemapbuf[mapbyte] & mask) == 0) {
+			allocblock(block);
+			bzero(zeros, sizeof(zeros));
+			diskwrite(zeros, block);
+			return block;
+		}
+	}
+	errx(1, "Filesystem too small for a hashed root directory "
+	     "-- use -l");
+}
+
+/*
+ * Allocate and zero the whole hash table of a hashed directory, so
+ * that it never has holes. Must come before writefreemap.
+ */
+static
+void
+allocdirhash(struct sfs_dinode *sfi, uint32_t fsblocks)
+{
+	uint32_t indirect[SFS_DBPERIDB];
+	uint32_t nblocks, i;
+
+	nblocks = SFS_DIRHASH_SIZE / SFS_BLOCKSIZE;
+	assert(nblocks > SFS_NDIRECT);
+	assert(nblocks <= SFS_NDIRECT + SFS_DBPERIDB);
+
+	bzero((void *)indirect, sizeof(indirect));
+	for (i=0; i<nblocks; i++) {
+		if (i < SFS_NDIRECT) {
+			sfi->sfi_direct[i] = SWAP32(newblock(fsblocks));
+		}
+		else {
+			indirect[i - SFS_NDIRECT] =
+				SWAP32(newblock(fsblocks));
+		}
+	}
+	sfi->sfi_indirect = SWAP32(newblock(fsblocks));
+	diskwrite(indirect, SWAP32(sfi->sfi_indirect));
+}
+
+/*
+ * Write out the root directory inode. Unless LINEAR is set, the root
+ * directory is a hash table.
  */
 static
 void
-writerootdir(void)
+writerootdir(int linear, uint32_t fsblocks)
 {
 	struct sfs_dinode sfi;
 
@@ -179,6 +234,12 @@ writerootdir(void)
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAP16(1);
 
+	if (!linear) {
+		allocdirhash(&sfi, fsblocks);
+		sfi.sfi_size = SWAP32(SFS_DIRHASH_SIZE);
+		sfi.sfi_flags = SWAP32(SFS_INODEF_HASHDIR);
+	}
+
 	/* Write it out */
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
 }
@@ -191,13 +252,21 @@ main(int argc, char **argv)
 {
 	uint32_t size, blocksize;
 	char *volname, *s;
+	int linear = 0;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	/* -l makes an old-style linear root directory */
+	if (argc==4 && !strcmp(argv[1], "-l")) {
+		linear = 1;
+		argc--;
+		argv++;
+	}
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-l] device/diskfile volume-name");
 	}
 
 	check();
@@ -231,8 +300,8 @@ main(int argc, char **argv)
 	/* Write out the on-disk structures */
 	initfreemap(size);
 	writesuper(volname, size);
+	writerootdir(linear, size);
 	writefreemap(size);
-	writerootdir();
 
 	closedisk();
 
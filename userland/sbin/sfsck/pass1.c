@@ -277,6 +277,35 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 		changed = 1;
 	}
 
+	if (sfi->sfi_flags & ~SFS_INODEF_HASHDIR) {
+		warnx("Inode %lu: unknown flags 0x%lx (cleared)",
+		      (unsigned long) ino,
+		      (unsigned long) (sfi->sfi_flags & ~SFS_INODEF_HASHDIR));
+		setbadness(EXIT_RECOV);
+		sfi->sfi_flags &= SFS_INODEF_HASHDIR;
+		changed = 1;
+	}
+
+	if (sfi->sfi_flags & SFS_INODEF_HASHDIR) {
+		if (!isdir) {
+			warnx("Inode %lu: hashed directory flag on a "
+			      "regular file (cleared)", (unsigned long) ino);
+			setbadness(EXIT_RECOV);
+			sfi->sfi_flags &= ~SFS_INODEF_HASHDIR;
+			changed = 1;
+		}
+		else if (sfi->sfi_size != SFS_DIRHASH_SIZE) {
+			/* it can still be read as a plain directory */
+			warnx("Inode %lu: hashed directory has size %lu, "
+			      "not %lu (made plain)", (unsigned long) ino,
+			      (unsigned long) sfi->sfi_size,
+			      (unsigned long) SFS_DIRHASH_SIZE);
+			setbadness(EXIT_RECOV);
+			sfi->sfi_flags &= ~SFS_INODEF_HASHDIR;
+			changed = 1;
+		}
+	}
+
 	if (check_inode_blocks(ino, sfi, isdir)) {
 		changed = 1;
 	}
@@ -289,11 +318,14 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 
 /*
  * Check the directory entry in SFD. INDEX is its offset, and PATH is
- * its name; these are used for printing messages.
+ * its name; these are used for printing messages. ISHASHED is set for
+ * hashed directories, where an entry with a name but no file is a
+ * deleted entry and is left alone.
  */
 static
 int
-pass1_direntry(const char *path, uint32_t index, struct sfs_direntry *sfd)
+pass1_direntry(const char *path, uint32_t index, struct sfs_direntry *sfd,
+	       int ishashed)
 {
 	int dchanged = 0;
 	uint32_t nblocks;
@@ -301,7 +333,7 @@ pass1_direntry(const char *path, uint32_t index, struct sfs_direntry *sfd)
 	nblocks = sb_totalblocks();
 
 	if (sfd->sfd_ino == SFS_NOINO) {
-		if (sfd->sfd_name[0] != 0) {
+		if (sfd->sfd_name[0] != 0 && !ishashed) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s entry %lu has name but no file",
 			      path, (unsigned long) index);
@@ -387,7 +419,8 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 	sfs_readdir(&sfi, direntries, ndirentries);
 
 	for (i=0; i<ndirentries; i++) {
-		if (pass1_direntry(pathsofar, i, &direntries[i])) {
+		if (pass1_direntry(pathsofar, i, &direntries[i],
+				   sfi.sfi_flags & SFS_INODEF_HASHDIR)) {
 			dchanged = 1;
 		}
 	}
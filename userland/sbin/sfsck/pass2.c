@@ -142,7 +142,10 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	 */
 
 	for (i=0; i<ndirentries; i++) {
-		if (!strcmp(direntries[i].sfd_name, ".")) {
+		if (direntries[i].sfd_ino == SFS_NOINO) {
+			/* deleted entries in hashed dirs keep their names */
+		}
+		else if (!strcmp(direntries[i].sfd_name, ".")) {
 			if (direntries[i].sfd_ino != ino) {
 				setbadness(EXIT_RECOV);
 				warnx("Directory %s: Incorrect `.' entry "
@@ -297,6 +300,25 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		ichanged = 1;
 	}
 
+	/*
+	 * In a hashed directory, entries fixed or added above, or
+	 * cleared by pass 1, may no longer be where a search from
+	 * their home slot finds them. Lay the table out again.
+	 */
+
+	if (sfi.sfi_flags & SFS_INODEF_HASHDIR) {
+		if (!dchanged &&
+		    sfsdir_hashcheck(direntries, ndirentries)) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory %s: Entries out of place in hash "
+			      "table (fixed)", pathsofar);
+			dchanged = 1;
+		}
+		if (dchanged) {
+			sfsdir_rehash(direntries, ndirentries);
+		}
+	}
+
 	/*
 	 * Write back anything that changed, clean up, and return.
 	 */
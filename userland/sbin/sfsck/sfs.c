@@ -81,6 +81,7 @@ swapinode(struct sfs_dinode *sfi)
 	sfi->sfi_size = SWAP32(sfi->sfi_size);
 	sfi->sfi_type = SWAP16(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAP16(sfi->sfi_linkcount);
+	sfi->sfi_flags = SWAP32(sfi->sfi_flags);
 
 	for (i=0; i<NUM_D; i++) {
 		SET_D(sfi, i) = SWAP32(GET_D(sfi, i));
@@ -462,3 +463,80 @@ sfsdir_tryadd(struct sfs_direntry *d, int nd, const char *name, uint32_t ino)
 	}
 	return -1;
 }
+
+/*
+ * Home slot of NAME in a hashed directory; must match the kernel.
+ */
+static
+unsigned
+sfsdir_hash(const char *name)
+{
+	uint32_t hash = SFS_FNV_OFFSET;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= SFS_FNV_PRIME;
+	}
+	return hash % SFS_DIRHASH_SLOTS;
+}
+
+/*
+ * Check that every entry in the hashed directory D (which has ND ==
+ * SFS_DIRHASH_SLOTS entries) can be found by searching from its home
+ * slot, that is, that no never-used slot lies in between.
+ *
+ * Returns 0 if so and nonzero otherwise.
+ */
+int
+sfsdir_hashcheck(struct sfs_direntry *d, unsigned nd)
+{
+	unsigned i, j;
+
+	assert(nd == SFS_DIRHASH_SLOTS);
+
+	for (i=0; i<nd; i++) {
+		if (d[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		for (j = sfsdir_hash(d[i].sfd_name); j != i; j = (j+1) % nd) {
+			if (d[j].sfd_ino == SFS_NOINO &&
+			    d[j].sfd_name[0] == 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Rebuild the hashed directory D (which has ND == SFS_DIRHASH_SLOTS
+ * entries), putting every entry back in the first free slot from its
+ * home slot and dropping deleted entries.
+ */
+void
+sfsdir_rehash(struct sfs_direntry *d, unsigned nd)
+{
+	struct sfs_direntry *old;
+	unsigned i, j;
+
+	assert(nd == SFS_DIRHASH_SLOTS);
+
+	old = domalloc(nd * sizeof(*old));
+	memcpy(old, d, nd * sizeof(*old));
+	bzero(d, nd * sizeof(*d));
+	for (i=0; i<nd; i++) {
+		d[i].sfd_ino = SFS_NOINO;
+	}
+
+	for (i=0; i<nd; i++) {
+		if (old[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		j = sfsdir_hash(old[i].sfd_name);
+		while (d[j].sfd_ino != SFS_NOINO) {
+			j = (j+1) % nd;
+		}
+		d[j] = old[i];
+	}
+	free(old);
+}
@@ -77,5 +77,9 @@ int sfsdir_tryadd(struct sfs_direntry *d, int nd,
 /* Sort a directory by creating a permutation vector. */
 void sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector);
 
+/* Check, and rebuild, the slot layout of a hashed directory. */
+int sfsdir_hashcheck(struct sfs_direntry *d, unsigned nd);
+void sfsdir_rehash(struct sfs_direntry *d, unsigned nd);
+
 
 #endif /* SFS_H */
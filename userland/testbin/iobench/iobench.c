@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * iobench - measure sequential file I/O throughput.
+ *
+ * Usage: iobench [filename [megabytes [chunk-kilobytes]]]
+ *
+ * Writes the file front to back in large chunks, then reads it back
+ * the same way, and reports the rate of each pass. With reads and
+ * writes going straight between the file system and user memory, this
+ * is mostly a measure of the disk and buffer handling underneath.
+ *
+ * The file is removed at the end. This kernel has no remove system
+ * call, so that fails here and the file is left behind; it is
+ * truncated again on the next run.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define DEFAULT_FILE	"iobench.dat"
+#define DEFAULT_MB	4
+#define DEFAULT_CHUNKKB	64
+#define MAX_CHUNKKB	256
+
+static char buffer[MAX_CHUNKKB * 1024];
+
+/* Elapsed time in milliseconds since the given start. */
+static
+unsigned long
+elapsed_ms(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < startnsecs) {
+		secs--;
+		nsecs += 1000000000;
+	}
+	return (secs - startsecs) * 1000 + (nsecs - startnsecs) / 1000000;
+}
+
+static
+void
+report(const char *what, unsigned long bytes, unsigned long ms)
+{
+	unsigned long kbps;
+
+	if (ms == 0) {
+		ms = 1;
+	}
+	kbps = (bytes / 1024) * 1000 / ms;
+	printf("%s: %lu KB in %lu.%03lu s, %lu.%02lu MB/s\n", what,
+	       bytes / 1024, ms / 1000, ms % 1000,
+	       kbps / 1024, (kbps % 1024) * 100 / 1024);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *filename = DEFAULT_FILE;
+	unsigned long size, chunk, done;
+	time_t startsecs;
+	unsigned long startnsecs;
+	ssize_t len;
+	int fd;
+
+	size = DEFAULT_MB;
+	chunk = DEFAULT_CHUNKKB;
+	if (argc > 1) {
+		filename = argv[1];
+	}
+	if (argc > 2) {
+		size = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		chunk = atoi(argv[3]);
+	}
+	if (argc > 4 || size == 0 || chunk == 0 || chunk > MAX_CHUNKKB) {
+		errx(1, "Usage: iobench [filename [megabytes [chunk-kilobytes]]]"
+		     " (chunk at most %d)", MAX_CHUNKKB);
+	}
+	size *= 1024 * 1024;
+	chunk *= 1024;
+
+	memset(buffer, 'i', chunk);
+
+	printf("iobench: %lu KB through %s in %lu KB chunks\n",
+	       size / 1024, filename, chunk / 1024);
+
+	fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s: create", filename);
+	}
+	__time(&startsecs, &startnsecs);
+	for (done = 0; done < size; done += len) {
+		len = write(fd, buffer, chunk);
+		if (len < 0) {
+			err(1, "%s: write", filename);
+		}
+		if (len == 0) {
+			errx(1, "%s: write: short write", filename);
+		}
+	}
+	report("write", done, elapsed_ms(startsecs, startnsecs));
+	close(fd);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", filename);
+	}
+	__time(&startsecs, &startnsecs);
+	for (done = 0; done < size; done += len) {
+		len = read(fd, buffer, chunk);
+		if (len < 0) {
+			err(1, "%s: read", filename);
+		}
+		if (len == 0) {
+			errx(1, "%s: read: unexpected EOF", filename);
+		}
+	}
+	report("read", done, elapsed_ms(startsecs, startnsecs));
+	close(fd);
+
+	if (remove(filename) < 0) {
+		warn("%s: remove (file left behind)", filename);
+	}
+	return 0;
+}
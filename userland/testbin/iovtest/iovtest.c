@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * iovtest - test readv, writev, pread and pwrite.
+ *
+ * Usage: iovtest [filename]
+ *
+ * Writes a file with writev, reads it back with readv, both through
+ * more iovecs than the kernel keeps on its stack, then checks pread
+ * and pwrite at known offsets and the error cases. pread and pwrite
+ * pass their 64-bit offset on the stack, so the offsets used include
+ * ones that come out wrong if the two halves are mixed up.
+ *
+ * There is no remove in the system call interface, so the file is
+ * left behind; it is truncated again on the next run.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <err.h>
+
+#define NIOV     13	/* more than the kernel's 8 on-stack iovecs */
+#define PIECE    37	/* odd, so the pieces straddle blocks unevenly */
+#define FILESIZE (NIOV * PIECE)
+
+static char data[FILESIZE];
+static char buf[FILESIZE];
+static char pieces[NIOV][PIECE];
+
+/*
+ * The expected contents of the file at offset POS.
+ */
+static
+char
+pattern(unsigned pos)
+{
+	return 'a' + (pos * 7) % 26;
+}
+
+/*
+ * Check that BUF holds LEN bytes of the file starting at offset POS.
+ */
+static
+void
+check(const char *what, const char *b, unsigned pos, unsigned len)
+{
+	unsigned i;
+
+	for (i=0; i<len; i++) {
+		if (b[i] != data[pos + i]) {
+			errx(1, "%s: byte %u is %c, not %c",
+			     what, pos + i, b[i], data[pos + i]);
+		}
+	}
+}
+
+/*
+ * Expect a call to have failed with ERRNUM.
+ */
+static
+void
+expect(const char *what, ssize_t rv, int errnum)
+{
+	if (rv >= 0) {
+		errx(1, "%s: succeeded (returned %ld)", what, (long) rv);
+	}
+	if (errno != errnum) {
+		err(1, "%s: wrong error (expected %s)", what, strerror(errnum));
+	}
+}
+
+static
+void
+test_vectors(const char *file)
+{
+	struct iovec iov[NIOV];
+	ssize_t rv;
+	unsigned i;
+	int fd;
+
+	for (i=0; i<NIOV; i++) {
+		memcpy(pieces[i], data + i * PIECE, PIECE);
+		iov[i].iov_base = pieces[i];
+		iov[i].iov_len = PIECE;
+	}
+
+	fd = open(file, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open for write", file);
+	}
+	rv = writev(fd, iov, NIOV);
+	if (rv < 0) {
+		err(1, "%s: writev", file);
+	}
+	if (rv != FILESIZE) {
+		errx(1, "%s: writev wrote %ld of %d bytes", file,
+		     (long) rv, FILESIZE);
+	}
+	close(fd);
+
+	/* read back through the iovecs in a different arrangement */
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open for read", file);
+	}
+	memset(pieces, 0, sizeof(pieces));
+	for (i=0; i<NIOV; i++) {
+		iov[NIOV - 1 - i].iov_base = pieces[i];
+		iov[NIOV - 1 - i].iov_len = PIECE;
+	}
+	rv = readv(fd, iov, NIOV);
+	if (rv < 0) {
+		err(1, "%s: readv", file);
+	}
+	if (rv != FILESIZE) {
+		errx(1, "%s: readv read %ld of %d bytes", file,
+		     (long) rv, FILESIZE);
+	}
+	for (i=0; i<NIOV; i++) {
+		check("readv", pieces[i], (NIOV - 1 - i) * PIECE, PIECE);
+	}
+
+	/* the file offset moved; there's nothing left to read */
+	rv = readv(fd, iov, NIOV);
+	if (rv != 0) {
+		errx(1, "%s: readv at EOF returned %ld", file, (long) rv);
+	}
+	close(fd);
+
+	printf("readv/writev: ok\n");
+}
+
+static
+void
+test_positional(const char *file)
+{
+	const unsigned pos = 100, len = 50;
+	char patch[50];
+	ssize_t rv;
+	unsigned i;
+	int fd;
+
+	fd = open(file, O_RDWR);
+	if (fd < 0) {
+		err(1, "%s: open", file);
+	}
+
+	/* move the file offset somewhere known first */
+	rv = read(fd, buf, 10);
+	if (rv != 10) {
+		err(1, "%s: read", file);
+	}
+
+	rv = pread(fd, buf, len, pos);
+	if (rv < 0) {
+		err(1, "%s: pread", file);
+	}
+	if (rv != (ssize_t) len) {
+		errx(1, "%s: pread read %ld of %u bytes", file,
+		     (long) rv, len);
+	}
+	check("pread", buf, pos, len);
+
+	for (i=0; i<len; i++) {
+		patch[i] = 'A' + i % 26;
+		data[pos + i] = patch[i];
+	}
+	rv = pwrite(fd, patch, len, pos);
+	if (rv < 0) {
+		err(1, "%s: pwrite", file);
+	}
+	if (rv != (ssize_t) len) {
+		errx(1, "%s: pwrite wrote %ld of %u bytes", file,
+		     (long) rv, len);
+	}
+
+	/* neither should have moved the offset from 10 */
+	rv = read(fd, buf, 20);
+	if (rv != 20) {
+		err(1, "%s: read after pread/pwrite", file);
+	}
+	check("offset after pread/pwrite", buf, 10, 20);
+
+	/* and the patch is where it belongs */
+	rv = pread(fd, buf, FILESIZE, 0);
+	if (rv != FILESIZE) {
+		err(1, "%s: pread of whole file", file);
+	}
+	check("pwrite", buf, 0, FILESIZE);
+
+	/* past EOF reads nothing */
+	rv = pread(fd, buf, 10, FILESIZE + 1000);
+	if (rv != 0) {
+		errx(1, "%s: pread past EOF returned %ld", file, (long) rv);
+	}
+
+	/*
+	 * A negative offset with a zero low word; read with the halves
+	 * swapped it would look like 4G-1 and be accepted.
+	 */
+	rv = pread(fd, buf, 10, -((off_t) 1 << 32));
+	expect("pread at negative offset", rv, EINVAL);
+	rv = pwrite(fd, buf, 10, -1);
+	expect("pwrite at negative offset", rv, EINVAL);
+
+	close(fd);
+
+	printf("pread/pwrite: ok\n");
+}
+
+static
+void
+test_errors(const char *file)
+{
+	struct iovec iov[1];
+	ssize_t rv;
+	int fd;
+
+	iov[0].iov_base = buf;
+	iov[0].iov_len = 10;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", file);
+	}
+	rv = readv(fd, iov, 0);
+	expect("readv with no iovecs", rv, EINVAL);
+	rv = readv(fd, iov, -1);
+	expect("readv with negative count", rv, EINVAL);
+	rv = readv(fd, iov, IOV_MAX + 1);
+	expect("readv with too many iovecs", rv, EINVAL);
+	rv = writev(fd, iov, 1);
+	expect("writev on read-only file", rv, EBADF);
+	close(fd);
+
+	rv = readv(fd, iov, 1);
+	expect("readv on closed file", rv, EBADF);
+	rv = pread(fd, buf, 10, 0);
+	expect("pread on closed file", rv, EBADF);
+
+	/* the console can't seek */
+	fd = open("con:", O_RDWR);
+	if (fd < 0) {
+		err(1, "con:: open");
+	}
+	rv = pread(fd, buf, 10, 0);
+	expect("pread on console", rv, ESPIPE);
+	rv = pwrite(fd, buf, 10, 0);
+	expect("pwrite on console", rv, ESPIPE);
+	close(fd);
+
+	printf("error cases: ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *file;
+	unsigned i;
+
+	if (argc == 0 || argc == 1) {
+		file = "iovtest.dat";
+	}
+	else if (argc == 2) {
+		file = argv[1];
+	}
+	else {
+		errx(1, "Usage: iovtest [filename]");
+	}
+
+	for (i=0; i<FILESIZE; i++) {
+		data[i] = pattern(i);
+	}
+
+	test_vectors(file);
+	test_positional(file);
+	test_errors(file);
+
+	printf("Passed iovtest.\n");
+	return 0;
+}